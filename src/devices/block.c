@@ -17,8 +17,7 @@ struct block
     const struct block_operations *ops;  /**< Driver operations. */
     void *aux;                          /**< Extra data owned by driver. */
 
-    unsigned long long read_cnt;        /**< Number of sectors read. */
-    unsigned long long write_cnt;       /**< Number of sectors written. */
+    struct block_stats stats;           /**< Sector counts and I/O time. */
   };
 
 /** List of all block devices. */
@@ -29,6 +28,16 @@ static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
 
+/** Returns the processor's time-stamp counter, for timing I/O
+   more finely than timer ticks allow. */
+static inline uint64_t
+read_tsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
 /** Returns a human-readable name for the given block device
    TYPE. */
 const char *
@@ -120,9 +129,13 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
+  uint64_t start;
+
   check_sector (block, sector);
+  start = read_tsc ();
   block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block->stats.read_cycles += read_tsc () - start;
+  block->stats.read_cnt++;
 }
 
 /** Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +146,65 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
+  uint64_t start;
+
   check_sector (block, sector);
   ASSERT (block->type != BLOCK_FOREIGN);
+  start = read_tsc ();
   block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  block->stats.write_cycles += read_tsc () - start;
+  block->stats.write_cnt++;
+}
+
+/** Reads the CNT consecutive sectors starting at SECTOR from BLOCK,
+   sector I into BUFFERS[I], each of which must have room for
+   BLOCK_SECTOR_SIZE bytes.  Drivers that support it do this as a
+   single multi-sector request. */
+void
+block_readv (struct block *block, block_sector_t sector, size_t cnt,
+             void *buffers[])
+{
+  uint64_t start;
+  size_t i;
+
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  start = read_tsc ();
+  if (block->ops->readv != NULL)
+    block->ops->readv (block->aux, sector, cnt, buffers);
+  else
+    for (i = 0; i < cnt; i++)
+      block->ops->read (block->aux, sector + i, buffers[i]);
+  block->stats.read_cycles += read_tsc () - start;
+  block->stats.read_cnt += cnt;
+}
+
+/** Writes the CNT consecutive sectors starting at SECTOR to BLOCK,
+   sector I from BUFFERS[I], each of which must contain
+   BLOCK_SECTOR_SIZE bytes.  Drivers that support it do this as a
+   single multi-sector request. */
+void
+block_writev (struct block *block, block_sector_t sector, size_t cnt,
+              const void *buffers[])
+{
+  uint64_t start;
+  size_t i;
+
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  ASSERT (block->type != BLOCK_FOREIGN);
+  start = read_tsc ();
+  if (block->ops->writev != NULL)
+    block->ops->writev (block->aux, sector, cnt, buffers);
+  else
+    for (i = 0; i < cnt; i++)
+      block->ops->write (block->aux, sector + i, buffers[i]);
+  block->stats.write_cycles += read_tsc () - start;
+  block->stats.write_cnt += cnt;
 }
 
 /** Returns the number of sectors in BLOCK. */
@@ -160,6 +228,13 @@ block_type (struct block *block)
   return block->type;
 }
 
+/** Copies BLOCK's cumulative statistics into *STATS. */
+void
+block_get_stats (struct block *block, struct block_stats *stats)
+{
+  *stats = block->stats;
+}
+
 /** Prints statistics for each block device used for a Pintos role. */
 void
 block_print_stats (void)
@@ -171,9 +246,11 @@ block_print_stats (void)
       struct block *block = block_by_role[i];
       if (block != NULL)
         {
-          printf ("%s (%s): %llu reads, %llu writes\n",
+          printf ("%s (%s): %llu reads, %llu writes, "
+                  "%llu read cycles, %llu write cycles\n",
                   block->name, block_type_name (block->type),
-                  block->read_cnt, block->write_cnt);
+                  block->stats.read_cnt, block->stats.write_cnt,
+                  block->stats.read_cycles, block->stats.write_cycles);
         }
     }
 }
@@ -198,8 +275,7 @@ block_register (const char *name, enum block_type type,
   block->size = size;
   block->ops = ops;
   block->aux = aux;
-  block->read_cnt = 0;
-  block->write_cnt = 0;
+  memset (&block->stats, 0, sizeof block->stats);
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -53,10 +53,22 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_readv (struct block *, block_sector_t, size_t cnt, void *buffers[]);
+void block_writev (struct block *, block_sector_t, size_t cnt,
+                   const void *buffers[]);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
 /** Statistics. */
+struct block_stats
+  {
+    unsigned long long read_cnt;        /**< Number of sectors read. */
+    unsigned long long write_cnt;       /**< Number of sectors written. */
+    unsigned long long read_cycles;     /**< TSC cycles spent in reads. */
+    unsigned long long write_cycles;    /**< TSC cycles spent in writes. */
+  };
+
+void block_get_stats (struct block *, struct block_stats *);
 void block_print_stats (void);
 
 /** Lower-level interface to block device drivers. */
@@ -65,6 +77,13 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional: transfer CNT consecutive sectors as one request,
+       scattering them to (or gathering them from) BUFFERS[0...CNT-1].
+       If null, the block layer issues CNT single-sector requests. */
+    void (*readv) (void *aux, block_sector_t, size_t cnt, void *buffers[]);
+    void (*writev) (void *aux, block_sector_t, size_t cnt,
+                    const void *buffers[]);
   };
 
 struct block *block_register (const char *name, enum block_type,
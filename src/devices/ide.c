@@ -50,6 +50,9 @@
 #define CMD_READ_SECTOR_RETRY 0x20      /**< READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /**< WRITE SECTOR with retries. */
 
+/** Most sectors a single READ/WRITE SECTOR command can transfer. */
+#define MAX_SECTORS_PER_CMD 256
+
 /** An ATA device. */
 struct ata_disk
   {
@@ -86,6 +89,7 @@ static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
 static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sectors (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -376,10 +380,81 @@ ide_write (void *d_, block_sector_t sec_no, const void *buffer)
   lock_release (&c->lock);
 }
 
+/** Reads the CNT sectors starting at SEC_NO from disk D, sector
+   I into BUFFERS[I], using one READ SECTOR command per up to
+   MAX_SECTORS_PER_CMD sectors.  The disk interrupts once per
+   sector as each becomes ready.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_readv (void *d_, block_sector_t sec_no, size_t cnt, void *buffers[])
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+  lock_acquire (&c->lock);
+  while (cnt > 0)
+    {
+      size_t batch = cnt < MAX_SECTORS_PER_CMD ? cnt : MAX_SECTORS_PER_CMD;
+      size_t i;
+
+      select_sectors (d, sec_no, batch);
+      issue_pio_command (c, CMD_READ_SECTOR_RETRY);
+      for (i = 0; i < batch; i++)
+        {
+          sema_down (&c->completion_wait);
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                   d->name, sec_no + i);
+          input_sector (c, buffers[i]);
+        }
+      sec_no += batch;
+      buffers += batch;
+      cnt -= batch;
+    }
+  lock_release (&c->lock);
+}
+
+/** Writes the CNT sectors starting at SEC_NO to disk D, sector I
+   from BUFFERS[I], using one WRITE SECTOR command per up to
+   MAX_SECTORS_PER_CMD sectors.  Returns after the disk has
+   acknowledged receiving all of the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_writev (void *d_, block_sector_t sec_no, size_t cnt,
+            const void *buffers[])
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+  lock_acquire (&c->lock);
+  while (cnt > 0)
+    {
+      size_t batch = cnt < MAX_SECTORS_PER_CMD ? cnt : MAX_SECTORS_PER_CMD;
+      size_t i;
+
+      select_sectors (d, sec_no, batch);
+      issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
+      for (i = 0; i < batch; i++)
+        {
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                   d->name, sec_no + i);
+          output_sector (c, buffers[i]);
+          sema_down (&c->completion_wait);
+        }
+      sec_no += batch;
+      buffers += batch;
+      cnt -= batch;
+    }
+  lock_release (&c->lock);
+}
+
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_readv,
+    ide_writev
   };
 
 /** Selects device D, waiting for it to become ready, and then
@@ -387,13 +462,23 @@ static struct block_operations ide_operations =
    use LBA mode.) */
 static void
 select_sector (struct ata_disk *d, block_sector_t sec_no)
+{
+  select_sectors (d, sec_no, 1);
+}
+
+/** As select_sector(), but selects the CNT sectors starting at
+   SEC_NO for the next command.  A count of 256 is written as 0,
+   as the ATA standard requires. */
+static void
+select_sectors (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= MAX_SECTORS_PER_CMD);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_SECTORS_PER_CMD ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
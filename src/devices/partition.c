@@ -317,8 +317,30 @@ partition_write (void *p_, block_sector_t sector, const void *buffer)
   block_write (p->block, p->start + sector, buffer);
 }
 
+/** Reads CNT sectors starting at SECTOR from partition P into
+   BUFFERS, as block_readv(). */
+static void
+partition_readv (void *p_, block_sector_t sector, size_t cnt,
+                 void *buffers[])
+{
+  struct partition *p = p_;
+  block_readv (p->block, p->start + sector, cnt, buffers);
+}
+
+/** Writes CNT sectors starting at SECTOR to partition P from
+   BUFFERS, as block_writev(). */
+static void
+partition_writev (void *p_, block_sector_t sector, size_t cnt,
+                  const void *buffers[])
+{
+  struct partition *p = p_;
+  block_writev (p->block, p->start + sector, cnt, buffers);
+}
+
 static struct block_operations partition_operations =
   {
     partition_read,
-    partition_write
+    partition_write,
+    partition_readv,
+    partition_writev
   };
@@ -132,6 +132,7 @@ print_stats (void)
   thread_print_stats ();
 #ifdef FILESYS
   block_print_stats ();
+  filesys_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
@@ -0,0 +1,251 @@
+#include "filesys/cache-policy.h"
+#include "filesys/cache.h"
+#include "threads/malloc.h"
+#include "lib/kernel/list.h"
+#include "lib/kernel/hash.h"
+#include <debug.h>
+#include <string.h>
+
+/* Policy used unless -cache-policy says otherwise */
+const char *cache_policy_name = "2q";
+
+static const struct cache_policy *policies[] = {
+    &cache_policy_clock,
+    &cache_policy_2q,
+};
+
+/* Returns the policy called NAME, or a null pointer if there is none */
+const struct cache_policy *cache_policy_lookup(const char *name) {
+    for (size_t i = 0; i < sizeof policies / sizeof *policies; i++) {
+        if (!strcmp(policies[i]->name, name)) {
+            return policies[i];
+        }
+    }
+    return NULL;
+}
+
+//-------------------------------------------------//
+/* clock: one hand sweeping all blocks, with a      */
+/* second chance for recently used ones             */
+//-------------------------------------------------//
+static struct list clock_ring;
+static size_t clock_cnt;
+/* Current position of the clock hand in clock_ring, null if it is empty */
+static struct list_elem *clock_hand;
+
+/* Move the hand onto the next block in the ring, wrapping around */
+static void clock_advance(void) {
+    clock_hand = list_next(clock_hand);
+    if (clock_hand == list_end(&clock_ring)) {
+        clock_hand = list_begin(&clock_ring);
+    }
+}
+
+static void clock_init(size_t entry_cnt UNUSED) {
+    list_init(&clock_ring);
+    clock_cnt = 0;
+    clock_hand = NULL;
+}
+
+static void clock_add(struct buffer_block *entry) {
+    entry->used = 0;
+    list_push_back(&clock_ring, &entry->policy_elem);
+    clock_cnt++;
+    if (clock_hand == NULL) {
+        clock_hand = &entry->policy_elem;
+    }
+}
+
+static void clock_remove(struct buffer_block *entry) {
+    if (clock_hand == &entry->policy_elem) {
+        clock_advance();
+    }
+    list_remove(&entry->policy_elem);
+    if (--clock_cnt == 0) {
+        clock_hand = NULL;
+    }
+}
+
+static void clock_replace(struct buffer_block *entry, block_sector_t sector UNUSED) {
+    entry->used = 1;
+}
+
+static void clock_access(struct buffer_block *entry) {
+    entry->used = 1;
+}
+
+static struct buffer_block *clock_select(void) {
+    // Two full turns of the hand clear every reference bit, so if nothing
+    // turned up by then every block is pinned
+    for (size_t i = 0; i < 2 * clock_cnt; i++) {
+        struct buffer_block *entry = list_entry(clock_hand, struct buffer_block, policy_elem);
+        clock_advance();
+
+        // Blocks in use by another thread can't be evicted
+        if (entry->pin_cnt > 0) {
+            continue;
+        }
+        // Give recently used blocks a second chance
+        if (entry->used) {
+            entry->used = 0;
+            continue;
+        }
+        return entry;
+    }
+    return NULL;
+}
+
+const struct cache_policy cache_policy_clock = {
+    "clock", clock_init, clock_add, clock_remove, clock_replace, clock_access, clock_select,
+};
+
+//-------------------------------------------------//
+/* 2Q (Johnson and Shasha): new sectors enter a     */
+/* FIFO, A1in, and only sectors referenced again    */
+/* after leaving it reach the LRU queue Am, so one  */
+/* pass over a big file cannot push out hot blocks  */
+//-------------------------------------------------//
+#define Q2_IN_FRACTION 4    /* A1in holds a quarter of the cache */
+#define Q2_OUT_FRACTION 2   /* A1out remembers half as many sectors as the cache holds */
+
+enum q2_queue { Q2_FREE, Q2_A1IN, Q2_AM };
+
+static struct list q2_free;     /* Blocks holding no sector */
+static struct list q2_a1in;     /* FIFO of sectors seen once, newest at the front */
+static struct list q2_am;       /* LRU of hot sectors, most recent at the front */
+static size_t q2_a1in_cnt;
+static size_t q2_a1in_max;
+
+/* A1out: the sectors most recently pushed out of A1in, without their
+   data.  A ring of q2_ghost_cnt slots, indexed by sector; a slot whose
+   sector is -1 is not in the index. */
+struct q2_ghost {
+    block_sector_t sector;
+    struct hash_elem elem;
+};
+static struct q2_ghost *q2_ghosts;
+static size_t q2_ghost_cnt;
+static size_t q2_ghost_next;    /* Slot to overwrite next */
+static struct hash q2_ghost_index;
+
+static unsigned q2_ghost_hash(const struct hash_elem *e, void *aux UNUSED) {
+    return hash_int(hash_entry(e, struct q2_ghost, elem)->sector);
+}
+
+static bool q2_ghost_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED) {
+    return hash_entry(a, struct q2_ghost, elem)->sector
+           < hash_entry(b, struct q2_ghost, elem)->sector;
+}
+
+/* Remember SECTOR in A1out, forgetting the oldest sector there if full */
+static void q2_ghost_add(block_sector_t sector) {
+    struct q2_ghost *ghost = &q2_ghosts[q2_ghost_next];
+    q2_ghost_next = (q2_ghost_next + 1) % q2_ghost_cnt;
+    if (ghost->sector != (block_sector_t) -1) {
+        hash_delete(&q2_ghost_index, &ghost->elem);
+    }
+    ghost->sector = sector;
+    if (hash_insert(&q2_ghost_index, &ghost->elem) != NULL) {
+        // Already remembered in another slot
+        ghost->sector = (block_sector_t) -1;
+    }
+}
+
+/* Forget SECTOR from A1out, returning true if it was there */
+static bool q2_ghost_take(block_sector_t sector) {
+    struct q2_ghost probe;
+    probe.sector = sector;
+    struct hash_elem *e = hash_delete(&q2_ghost_index, &probe.elem);
+    if (e == NULL) {
+        return false;
+    }
+    hash_entry(e, struct q2_ghost, elem)->sector = (block_sector_t) -1;
+    return true;
+}
+
+/* Returns the unpinned block closest to the back of QUEUE, or null */
+static struct buffer_block *q2_oldest_unpinned(struct list *queue) {
+    for (struct list_elem *e = list_rbegin(queue); e != list_rend(queue); e = list_prev(e)) {
+        struct buffer_block *entry = list_entry(e, struct buffer_block, policy_elem);
+        if (entry->pin_cnt == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void q2_init(size_t entry_cnt) {
+    list_init(&q2_free);
+    list_init(&q2_a1in);
+    list_init(&q2_am);
+    q2_a1in_cnt = 0;
+    q2_a1in_max = entry_cnt / Q2_IN_FRACTION > 0 ? entry_cnt / Q2_IN_FRACTION : 1;
+
+    q2_ghost_cnt = entry_cnt / Q2_OUT_FRACTION > 0 ? entry_cnt / Q2_OUT_FRACTION : 1;
+    q2_ghost_next = 0;
+    q2_ghosts = malloc(q2_ghost_cnt * sizeof *q2_ghosts);
+    if (q2_ghosts == NULL || !hash_init(&q2_ghost_index, q2_ghost_hash, q2_ghost_less, NULL)) {
+        PANIC("Failed to allocate 2Q cache policy state");
+    }
+    for (size_t i = 0; i < q2_ghost_cnt; i++) {
+        q2_ghosts[i].sector = (block_sector_t) -1;
+    }
+}
+
+static void q2_add(struct buffer_block *entry) {
+    entry->queue = Q2_FREE;
+    list_push_back(&q2_free, &entry->policy_elem);
+}
+
+static void q2_remove(struct buffer_block *entry) {
+    if (entry->queue == Q2_A1IN) {
+        q2_a1in_cnt--;
+    }
+    list_remove(&entry->policy_elem);
+}
+
+static void q2_replace(struct buffer_block *entry, block_sector_t sector) {
+    // A sector leaving A1in is remembered, so that a second reference
+    // soon after shows it is worth keeping
+    if (entry->queue == Q2_A1IN && entry->sector != (block_sector_t) -1) {
+        q2_ghost_add(entry->sector);
+    }
+    q2_remove(entry);
+
+    if (q2_ghost_take(sector)) {
+        entry->queue = Q2_AM;
+        list_push_front(&q2_am, &entry->policy_elem);
+    } else {
+        entry->queue = Q2_A1IN;
+        list_push_front(&q2_a1in, &entry->policy_elem);
+        q2_a1in_cnt++;
+    }
+}
+
+static void q2_access(struct buffer_block *entry) {
+    // Hits in A1in are correlated references (several small reads of
+    // one sector, say) and prove nothing, so only Am is reordered
+    if (entry->queue == Q2_AM) {
+        list_remove(&entry->policy_elem);
+        list_push_front(&q2_am, &entry->policy_elem);
+    }
+}
+
+static struct buffer_block *q2_select(void) {
+    struct buffer_block *entry;
+    if (!list_empty(&q2_free)) {
+        return list_entry(list_front(&q2_free), struct buffer_block, policy_elem);
+    }
+    // Take from A1in while it is over its share, otherwise from Am
+    if (q2_a1in_cnt > q2_a1in_max && (entry = q2_oldest_unpinned(&q2_a1in)) != NULL) {
+        return entry;
+    }
+    if ((entry = q2_oldest_unpinned(&q2_am)) != NULL) {
+        return entry;
+    }
+    return q2_oldest_unpinned(&q2_a1in);
+}
+
+const struct cache_policy cache_policy_2q = {
+    "2q", q2_init, q2_add, q2_remove, q2_replace, q2_access, q2_select,
+};
@@ -0,0 +1,41 @@
+#ifndef FILESYS_CACHE_POLICY_H
+#define FILESYS_CACHE_POLICY_H
+
+#include <stddef.h>
+#include "devices/block.h"
+
+struct buffer_block;
+
+/* A buffer cache replacement policy.  The cache calls these with its
+   global lock held, so a policy needs no locking of its own.  A policy
+   keeps its per-block state in the block's policy_elem and queue
+   fields and must not touch anything else in the block except to read
+   sector and pin_cnt. */
+struct cache_policy {
+    const char *name;
+    /* Prepare for a cache of ENTRY_CNT blocks */
+    void (*init)(size_t entry_cnt);
+    /* ENTRY joins the cache holding no sector */
+    void (*add)(struct buffer_block *entry);
+    /* ENTRY leaves the cache for good */
+    void (*remove)(struct buffer_block *entry);
+    /* ENTRY is about to be re-keyed to SECTOR; its old sector, if any,
+       is still in entry->sector */
+    void (*replace)(struct buffer_block *entry, block_sector_t sector);
+    /* ENTRY was found by a lookup */
+    void (*access)(struct buffer_block *entry);
+    /* Returns an unpinned block to reuse, preferring ones holding no
+       sector, or a null pointer if every block is pinned */
+    struct buffer_block *(*select)(void);
+};
+
+extern const struct cache_policy cache_policy_clock;
+extern const struct cache_policy cache_policy_2q;
+
+/* Name of the policy to use, set from the kernel command line
+   (-cache-policy) before filesys_init() */
+extern const char *cache_policy_name;
+
+const struct cache_policy *cache_policy_lookup(const char *name);
+
+#endif /* filesys/cache-policy.h */
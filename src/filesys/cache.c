@@ -1,169 +1,1023 @@
 #include "filesys/cache.h"
+#include "filesys/cache-policy.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/thread.h"
 #include "lib/kernel/list.h"
+#include "lib/kernel/hash.h"
 #include "devices/block.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <round.h>
 #include "devices/timer.h"
+#include "threads/loader.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
 
-#define NUM_SECTORS 128 /* Number of sectors in the buffer cache */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+/* Smallest cache we boot with or shrink to, in which a full journal
+   transaction takes at most a quarter */
+#define CACHE_MIN_SECTORS (4 * JOURNAL_TXN_MAX)
+#define CACHE_MAX_SECTORS 8192   /* Largest default cache (4 MB) */
+#define CACHE_RAM_FRACTION 64    /* Default cache size is 1/64th of RAM */
+
+/* Number of sectors to cache, set from the kernel command line (-cache)
+   before filesys_init().  0 picks a size proportional to RAM. */
+int cache_size = 0;
+
+/* Write-behind tunables, in milliseconds.  Set from the kernel
+   command line (-cache-flush, -cache-age) before filesys_init(). */
+int cache_flush_interval = 1000;  /* How often the flusher wakes up; 0 disables it */
+int cache_dirty_age = 2000;       /* How long a block may stay dirty before the flusher writes it */
+
+#define READ_AHEAD_QUEUE 64 /* Maximum number of queued read-ahead requests */
+#define RANGE_BATCH 32      /* Most blocks a ranged transfer or write-back run covers */
+/* Temporary sector numbers stay below this, leaving the top bit free for the block map's flags */
+#define TEMP_LIMIT ((block_sector_t) 1 << 31)
+
+/* A lock for synchronizing the buffer cache index and replacement state.
+   It protects cache_list, cache_index, the replacement policy and every
+   entry's sector, pin_cnt and policy fields.  It is never held across disk I/O;
+   the per-entry lock covers that. */
+static struct lock buffer_cache_lock;
+
+/* Sector-keyed index over the entries in cache_list, so lookups don't
+   have to walk the whole clock ring.  Protected by buffer_cache_lock. */
+static struct hash cache_index;
+
+/* The entries, SECTORS_PER_PAGE of them per page of cache_pages, which
+   holds their data.  Entries whose page was given back to the page
+   allocator have a null buf and are off cache_list. */
+static struct buffer_block *cache_entries;
+static size_t cache_entry_cnt;
+static uint8_t *cache_pages;
+static size_t cache_live_cnt;   /* Entries still on cache_list */
+
+/* Blocks held by the journal, at most one transaction's worth, which
+   CACHE_MIN_SECTORS keeps to a quarter of the cache so that eviction
+   always has blocks to choose from.  Protected by buffer_cache_lock. */
+static size_t held_cnt;
+
+/* Delayed blocks hold the data of file blocks that have no disk sector
+   yet, under temporary sector numbers past the end of the disk, handed
+   out in turn from NEXT_TEMP.  They are pinned until the file system
+   assigns them a sector, so they too may take at most a quarter of the
+   cache.  Protected by buffer_cache_lock. */
+static block_sector_t disk_size;
+static block_sector_t next_temp;
+static size_t delayed_cnt;
+
+/* Counters reported by buffer_cache_get_stats(), protected by
+   buffer_cache_lock.  Only the cache_* members are used. */
+static struct fsstat cache_stats;
+
+/* Scratch array for the write-behind thread, cache_entry_cnt long */
+static struct buffer_block **flush_batch;
+
+/* Replacement policy, chosen by cache_policy_name at init */
+static const struct cache_policy *policy;
+
+/* Ring of sectors waiting to be prefetched by the read-ahead thread.
+   Requests that don't fit are dropped; read-ahead is only a hint. */
+static block_sector_t read_ahead_queue[READ_AHEAD_QUEUE];
+static size_t read_ahead_head;      /* Index of the oldest request */
+static size_t read_ahead_cnt;       /* Number of queued requests */
+static struct lock read_ahead_lock; /* Protects the ring */
+static struct condition read_ahead_cond; /* Signaled when a request is queued */
 
 /* function prototypes */
-static void buffer_cache_flush(struct buffer_block *entry);
-static struct buffer_block* buffer_cache_evict(void);
+static bool buffer_cache_flush(struct buffer_block *entry);
+static struct buffer_block* buffer_cache_evict(bool *all_pinned);
+static void buffer_cache_claim(struct buffer_block *entry, block_sector_t sector);
+static struct buffer_block *buffer_cache_acquire(block_sector_t sector, bool fill);
+static void buffer_cache_release(struct buffer_block *entry, bool dirty, block_sector_t owner, bool meta);
+static void buffer_cache_mark_dirty(struct buffer_block *entry, block_sector_t owner, bool meta);
+static size_t buffer_cache_transfer(const block_sector_t *sectors, size_t cnt, uint8_t *data,
+                                    int sector_ofs, size_t size, bool write, block_sector_t owner,
+                                    bool meta);
+static size_t buffer_cache_write_run(struct buffer_block **batch, size_t cnt);
+static void buffer_cache_flusher(void *aux);
+static void buffer_cache_flush_aged(int64_t age);
+static void buffer_cache_write_back(struct buffer_block **batch, size_t batch_cnt);
+static int buffer_cache_sector_cmp(const void *a, const void *b);
+static void buffer_cache_read_ahead_worker(void *aux);
+static size_t buffer_cache_shrink(size_t page_cnt);
+static unsigned buffer_cache_hash(const struct hash_elem *e, void *aux);
+static bool buffer_cache_less(const struct hash_elem *a, const struct hash_elem *b, void *aux);
 
-/* Initialize cache_list and allocate memory for buffer cache entries */
+/* Initialize cache_list and allocate memory for buffer cache entries.
+   The data lives in contiguous pages from the user pool, which the page
+   allocator can reclaim through buffer_cache_shrink() when it runs low. */
 void buffer_cache_init(void) {
     // Initialize the lock and buffer cache list
     list_init(&cache_list);
     lock_init(&buffer_cache_lock);
+    if (!hash_init(&cache_index, buffer_cache_hash, buffer_cache_less, NULL)) {
+        PANIC("Failed to allocate buffer cache index");
+    }
 
-    // Create the buffer cache 
-    for (int i = 0; i < NUM_SECTORS; i++) {
-        // Create a buffer block entry
-        struct buffer_block *entry = malloc(sizeof(struct buffer_block));
-        if (entry == NULL) {
-            PANIC("Failed to allocate memory for buffer cache entry");
+    // Size the cache, in whole pages
+    size_t sectors = cache_size;
+    if (cache_size <= 0) {
+        sectors = (size_t) init_ram_pages * PGSIZE / CACHE_RAM_FRACTION / BLOCK_SECTOR_SIZE;
+        if (sectors > CACHE_MAX_SECTORS) {
+            sectors = CACHE_MAX_SECTORS;
         }
-        // Allocate BLOCK_SECTOR_SIZE bytes for the block data 
-        entry->vaddr = malloc(BLOCK_SECTOR_SIZE);  
-        if(entry->vaddr == NULL) {
-            PANIC("Failed to allocate memory for buffer cache data");
+    }
+    if (sectors < CACHE_MIN_SECTORS) {
+        sectors = CACHE_MIN_SECTORS;
+    }
+    size_t page_cnt = DIV_ROUND_UP(sectors, SECTORS_PER_PAGE);
+
+    // Take the data pages from the user pool, settling for fewer if it
+    // is too small, and from the kernel pool as a last resort
+    bool user_pool = true;
+    while ((cache_pages = palloc_get_multiple(PAL_USER, page_cnt)) == NULL
+           && page_cnt * SECTORS_PER_PAGE > CACHE_MIN_SECTORS) {
+        page_cnt /= 2;
+        if (page_cnt * SECTORS_PER_PAGE < CACHE_MIN_SECTORS) {
+            page_cnt = CACHE_MIN_SECTORS / SECTORS_PER_PAGE;
         }
+    }
+    if (cache_pages == NULL) {
+        page_cnt = CACHE_MIN_SECTORS / SECTORS_PER_PAGE;
+        cache_pages = palloc_get_multiple(PAL_ASSERT, page_cnt);
+        user_pool = false;
+    }
+    cache_entry_cnt = page_cnt * SECTORS_PER_PAGE;
+    cache_entries = calloc(cache_entry_cnt, sizeof *cache_entries);
+    flush_batch = malloc(cache_entry_cnt * sizeof *flush_batch);
+    if (cache_entries == NULL || flush_batch == NULL) {
+        PANIC("Failed to allocate memory for buffer cache entries");
+    }
+
+    // Create the buffer cache
+    for (size_t i = 0; i < cache_entry_cnt; i++) {
+        struct buffer_block *entry = &cache_entries[i];
         // Fill the initial values
         entry->sector = (block_sector_t) -1;  /* Initialize sector to an invalid value */
         entry->dirty = 0;
         entry->used = 0;
         entry->accessed = 0;
+        entry->pin_cnt = 0;
+        entry->journaled = 0;
+        entry->delayed = 0;
+        entry->dirty_since = 0;
+        entry->prefetched = 0;
+        entry->owner = CACHE_NO_OWNER;
+        entry->buf = cache_pages + i * BLOCK_SECTOR_SIZE;
+        lock_init(&entry->lock);
         // Add to the list
         list_push_back(&cache_list, &entry->elem);
     }
+    cache_live_cnt = cache_entry_cnt;
+    disk_size = next_temp = block_size(fs_device);
+
+    policy = cache_policy_lookup(cache_policy_name);
+    if (policy == NULL) {
+        PANIC("Unknown buffer cache policy `%s'", cache_policy_name);
+    }
+    policy->init(cache_entry_cnt);
+    for (size_t i = 0; i < cache_entry_cnt; i++) {
+        policy->add(&cache_entries[i]);
+    }
+
+    lock_init(&read_ahead_lock);
+    cond_init(&read_ahead_cond);
+    read_ahead_head = read_ahead_cnt = 0;
+
+    // Only user pool pages are worth giving back under pressure
+    if (user_pool) {
+        palloc_set_user_shrinker(buffer_cache_shrink);
+    }
+    printf("Buffer cache: %zu sectors (%zu kB), %s replacement.\n",
+           cache_entry_cnt, cache_entry_cnt * BLOCK_SECTOR_SIZE / 1024, policy->name);
+}
+
+/* Gives up to PAGE_CNT pages of cache data back to the page allocator
+   and returns how many it freed.  Only pages whose blocks are all clean
+   and unpinned go, and the cache never shrinks below CACHE_MIN_SECTORS.
+   Called by palloc when the user pool runs out of pages. */
+static size_t buffer_cache_shrink(size_t page_cnt) {
+    size_t freed = 0;
+
+    lock_acquire(&buffer_cache_lock);
+    for (size_t page = 0; page < cache_entry_cnt / SECTORS_PER_PAGE && freed < page_cnt; page++) {
+        struct buffer_block *first = &cache_entries[page * SECTORS_PER_PAGE];
+        if (first->buf == NULL || cache_live_cnt - SECTORS_PER_PAGE < CACHE_MIN_SECTORS) {
+            continue;
+        }
+        bool idle = true;
+        for (size_t i = 0; i < SECTORS_PER_PAGE && idle; i++) {
+            idle = first[i].pin_cnt == 0 && !first[i].dirty;
+        }
+        if (!idle) {
+            continue;
+        }
+
+        // Retire the page's blocks
+        for (size_t i = 0; i < SECTORS_PER_PAGE; i++) {
+            struct buffer_block *entry = &first[i];
+            policy->remove(entry);
+            if (entry->sector != (block_sector_t)-1) {
+                hash_delete(&cache_index, &entry->hash_elem);
+            }
+            list_remove(&entry->elem);
+            entry->sector = (block_sector_t) -1;
+            entry->buf = NULL;
+        }
+        cache_live_cnt -= SECTORS_PER_PAGE;
+        palloc_free_page(cache_pages + page * PGSIZE);
+        freed++;
+    }
+    lock_release(&buffer_cache_lock);
+    return freed;
+}
+
+/* Start the write-behind thread, which periodically writes back blocks
+   that have been dirty for longer than cache_dirty_age.  This keeps the
+   amount of unwritten data bounded and makes most eviction victims
+   clean. */
+void buffer_cache_start_flusher(void) {
+    if (cache_flush_interval <= 0) {
+        return;
+    }
+    if (thread_create("cache-flusher", PRI_DEFAULT, buffer_cache_flusher, NULL) == TID_ERROR) {
+        PANIC("Failed to start buffer cache flusher");
+    }
+}
+
+/* Start the read-ahead thread, which loads the sectors queued by
+   buffer_cache_read_ahead() in the background */
+void buffer_cache_start_read_ahead(void) {
+    if (thread_create("cache-readahead", PRI_DEFAULT, buffer_cache_read_ahead_worker, NULL) == TID_ERROR) {
+        PANIC("Failed to start buffer cache read-ahead");
+    }
 }
 //-------------------------------------------------//
 /* buffer cache list operation functions           */
 //-------------------------------------------------//
-/* Helper function to find a buffer block in the cache */
+/* Hashes a buffer block by its sector number */
+static unsigned buffer_cache_hash(const struct hash_elem *e, void *aux UNUSED) {
+    const struct buffer_block *entry = hash_entry(e, struct buffer_block, hash_elem);
+    return hash_int(entry->sector);
+}
+
+/* Orders buffer blocks by sector number */
+static bool buffer_cache_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED) {
+    const struct buffer_block *entry_a = hash_entry(a, struct buffer_block, hash_elem);
+    const struct buffer_block *entry_b = hash_entry(b, struct buffer_block, hash_elem);
+    return entry_a->sector < entry_b->sector;
+}
+
+/* Helper function to find a buffer block in the cache.
+   The caller must hold buffer_cache_lock. */
 struct buffer_block *buffer_cache_find(block_sector_t sector) {
+    ASSERT(lock_held_by_current_thread(&buffer_cache_lock));
+    // Look the sector up in the index instead of walking the clock ring
+    struct buffer_block probe;
+    probe.sector = sector;
+    struct hash_elem *e = hash_find(&cache_index, &probe.hash_elem);
+    if (e == NULL) {
+        return NULL; // Cache miss
+    }
+    return hash_entry(e, struct buffer_block, hash_elem);
+}
+
+/* Helper function to pick a block to evict with the replacement policy.
+   Returns an unpinned, clean block, or a null pointer if there is none
+   right now.  In that case *ALL_PINNED tells why: if false, the cache
+   lock was dropped to write back a dirty victim and the caller must
+   redo its lookup because the index may have changed; if true, every
+   block is pinned and the caller has to wait for a holder to finish. */
+static struct buffer_block* buffer_cache_evict(bool *all_pinned) {
+    ASSERT(lock_held_by_current_thread(&buffer_cache_lock));
+    struct buffer_block *evict_entry = policy->select();
+    *all_pinned = evict_entry == NULL;
+    if (evict_entry == NULL) {
+        return NULL;
+    }
+    // Write a dirty victim back without holding the cache lock.  The
+    // block stays indexed under its old sector while the write is in
+    // progress, so readers of that sector wait on it instead of
+    // fetching stale data from disk.
+    if (evict_entry->dirty) {
+        evict_entry->pin_cnt++;
+        lock_acquire(&evict_entry->lock);
+        lock_release(&buffer_cache_lock);
+        bool written = buffer_cache_flush(evict_entry);
+        lock_release(&evict_entry->lock);
+        lock_acquire(&buffer_cache_lock);
+        evict_entry->pin_cnt--;
+        if (written) {
+            cache_stats.cache_dirty_evictions++;
+            cache_stats.cache_writebacks++;
+        }
+        return NULL;
+    }
+    if (evict_entry->sector != (block_sector_t)-1) {
+        cache_stats.cache_evictions++;
+    }
+    return evict_entry;
+}
+
+/* Re-keys the eviction victim ENTRY to SECTOR, pinned and with its own
+   lock held.  Done before buffer_cache_lock is dropped, so a concurrent
+   miss on the same sector finds this block and waits for our read
+   instead of loading a second copy.  The caller must hold the cache
+   lock. */
+static void buffer_cache_claim(struct buffer_block *entry, block_sector_t sector) {
+    ASSERT(lock_held_by_current_thread(&buffer_cache_lock));
+    policy->replace(entry, sector);
+    if (entry->sector != (block_sector_t)-1) {
+        hash_delete(&cache_index, &entry->hash_elem);
+    }
+    entry->sector = sector;
+    entry->dirty = 0;
+    entry->accessed = 1;
+    entry->pin_cnt = 1;
+    entry->prefetched = 0;
+    entry->owner = CACHE_NO_OWNER;
+    hash_insert(&cache_index, &entry->hash_elem);
+    // Nobody else can hold the lock of an unpinned block
+    lock_acquire(&entry->lock);
+}
+
+/* Write every dirty block back to disk and wait for it, except the
+   blocks held by the journal's running transaction */
+void buffer_cache_flush_all(void) {
+    // For loop writing all used sectors back to the disk
+    //printf("(buffer_cache_close) starting flushing to disk\n");
     struct list_elem *e;
-    // Use a for loop to iterate through the buffer cache list to try and find the block
+    lock_acquire(&buffer_cache_lock);
     for (e = list_begin(&cache_list); e != list_end(&cache_list); e = list_next(e)) {
         struct buffer_block *entry = list_entry(e, struct buffer_block, elem);
-        if (entry->sector == sector) {
-            return entry;
+        if (entry->sector != (block_sector_t)-1 && entry->dirty && !entry->journaled
+            && !entry->delayed) {
+            // Pin the block so it keeps its sector while we write it out
+            entry->pin_cnt++;
+            lock_release(&buffer_cache_lock);
+            lock_acquire(&entry->lock);
+            bool written = buffer_cache_flush(entry);
+            lock_release(&entry->lock);
+            lock_acquire(&buffer_cache_lock);
+            entry->pin_cnt--;
+            cache_stats.cache_writebacks += written;
         }
     }
-    return NULL; // Cache miss
+    lock_release(&buffer_cache_lock);
+    //printf("(buffer_cache_close) finished flushing to disk\n");
 }
 
-/* Helper function to evict the least recently used block from the cache */
-static struct buffer_block* buffer_cache_evict(void) {
-    //ASSERT(lock_held_by_current_thread(&buffer_cache_lock));
-    // Grab the first buffered block element in the list 
-    struct list_elem *e = list_begin(&cache_list);
-    struct buffer_block *evict_entry = list_entry(e, struct buffer_block, elem);
-    // Try to find an unused block to evict
-    while (true) {
-        // If the block is unused, it's a candidate for eviction
-        if (!evict_entry->used) {
-            if (evict_entry->dirty) {
-                buffer_cache_flush(evict_entry);
-            }
-            // Change the sector number to -1 to indicate the block is free
-            evict_entry->sector = (block_sector_t)-1;
-            return evict_entry;
+/* Close the buffer cache, flushing all dirty entries to disk. this is a write-back method */
+void buffer_cache_close(void) {
+    buffer_cache_flush_all();
+}
+/* Body of the write-behind thread */
+static void buffer_cache_flusher(void *aux UNUSED) {
+    int64_t interval = (int64_t) cache_flush_interval * TIMER_FREQ / 1000;
+    int64_t age = (int64_t) cache_dirty_age * TIMER_FREQ / 1000;
+    if (interval < 1) {
+        interval = 1;
+    }
+    for (;;) {
+        timer_sleep(interval);
+        // Give the delayed blocks that are old enough their sectors,
+        // then commit the metadata changed since last time, free map
+        // included, so that it can age along with the data
+        inode_flush_delayed(age);
+        journal_commit();
+        buffer_cache_flush_aged(age);
+    }
+}
+
+/* qsort() comparator ordering buffer blocks by sector number */
+static int buffer_cache_sector_cmp(const void *a, const void *b) {
+    const struct buffer_block *entry_a = *(struct buffer_block * const *) a;
+    const struct buffer_block *entry_b = *(struct buffer_block * const *) b;
+    return entry_a->sector < entry_b->sector ? -1 : entry_a->sector > entry_b->sector;
+}
+
+/* Writes the CNT dirty blocks in BATCH, whose sectors are consecutive,
+   with one device request, then releases their locks, which the caller
+   must hold.  Returns CNT. */
+static size_t buffer_cache_write_run(struct buffer_block **batch, size_t cnt) {
+    const void *buffers[RANGE_BATCH];
+    if (cnt == 0) {
+        return 0;
+    }
+    for (size_t i = 0; i < cnt; i++) {
+        ASSERT(lock_held_by_current_thread(&batch[i]->lock));
+        buffers[i] = batch[i]->buf;
+    }
+    block_writev(fs_device, batch[0]->sector, cnt, buffers);
+    for (size_t i = 0; i < cnt; i++) {
+        batch[i]->dirty = 0;
+        lock_release(&batch[i]->lock);
+    }
+    return cnt;
+}
+
+/* Body of the read-ahead thread: prefetch queued sectors, taking runs of
+   consecutive ones together so their misses go to disk as one request */
+static void buffer_cache_read_ahead_worker(void *aux UNUSED) {
+    block_sector_t run[RANGE_BATCH];
+    for (;;) {
+        size_t n = 0;
+        lock_acquire(&read_ahead_lock);
+        while (read_ahead_cnt == 0) {
+            cond_wait(&read_ahead_cond, &read_ahead_lock);
         }
-        // Mark the block as unused for eviction at a later date
-        evict_entry->used = 0;
-        // Move onto the next block in the list
-        e = list_next(e);
-        if (e == list_end(&cache_list)) {
-            // If the end of the list is reached, wrap back around
-            e = list_begin(&cache_list);
+        do {
+            run[n++] = read_ahead_queue[read_ahead_head];
+            read_ahead_head = (read_ahead_head + 1) % READ_AHEAD_QUEUE;
+            read_ahead_cnt--;
+        } while (read_ahead_cnt > 0 && n < RANGE_BATCH
+                 && read_ahead_queue[read_ahead_head] == run[n - 1] + 1);
+        lock_release(&read_ahead_lock);
+
+        for (size_t done = 0; done < n; ) {
+            done += buffer_cache_transfer(run + done, n - done, NULL, 0,
+                                          (n - done) * BLOCK_SECTOR_SIZE, false, CACHE_NO_OWNER, false);
         }
-        evict_entry = list_entry(e, struct buffer_block, elem);
     }
 }
 
-/* Close the buffer cache, flushing all dirty entries to disk. this is a write-back method */
-void buffer_cache_close(void) {
-    // For loop writing all used sectors back to the disk
-    //printf("(buffer_cache_close) starting flushing to disk\n");
+/* Write back every block that has been dirty for at least AGE ticks */
+static void buffer_cache_flush_aged(int64_t age) {
+    // Only the flusher thread calls this, so one shared batch will do
+    struct buffer_block **batch = flush_batch;
+    size_t batch_cnt = 0;
+    int64_t now = timer_ticks();
     struct list_elem *e;
+
+    lock_acquire(&buffer_cache_lock);
     for (e = list_begin(&cache_list); e != list_end(&cache_list); e = list_next(e)) {
         struct buffer_block *entry = list_entry(e, struct buffer_block, elem);
-        if (entry->sector != (block_sector_t)-1) {
-            buffer_cache_flush(entry);
+        if (entry->sector != (block_sector_t)-1 && entry->dirty && !entry->journaled
+            && !entry->delayed && now - entry->dirty_since >= age) {
+            entry->pin_cnt++;
+            batch[batch_cnt++] = entry;
         }
     }
-    //printf("(buffer_cache_close) finished flushing to disk\n");
+    lock_release(&buffer_cache_lock);
+    buffer_cache_write_back(batch, batch_cnt);
+}
+
+/* Write back every dirty block belonging to the file whose inode is at
+   sector OWNER, waiting until they are on disk.  Other dirty blocks are
+   left alone. */
+void buffer_cache_sync(block_sector_t owner) {
+    struct buffer_block **batch = malloc(cache_entry_cnt * sizeof *batch);
+    size_t batch_cnt = 0;
+    struct list_elem *e;
+
+    if (batch == NULL) {
+        // Writing everything back is slower but just as good
+        buffer_cache_close();
+        return;
+    }
+    lock_acquire(&buffer_cache_lock);
+    for (e = list_begin(&cache_list); e != list_end(&cache_list); e = list_next(e)) {
+        struct buffer_block *entry = list_entry(e, struct buffer_block, elem);
+        if (entry->sector != (block_sector_t)-1 && entry->dirty && !entry->journaled
+            && !entry->delayed && entry->owner == owner) {
+            entry->pin_cnt++;
+            batch[batch_cnt++] = entry;
+        }
+    }
+    lock_release(&buffer_cache_lock);
+    buffer_cache_write_back(batch, batch_cnt);
+    free(batch);
+}
+
+/* Write the BATCH_CNT blocks in BATCH, which the caller pinned, back to
+   disk in sector order so the disk sees one ascending sweep, then unpin
+   them.  Blocks that are clean by now, or that the journal has taken
+   since, are skipped. */
+static void buffer_cache_write_back(struct buffer_block **batch, size_t batch_cnt) {
+    size_t written = 0;
+    if (batch_cnt == 0) {
+        return;
+    }
+
+    qsort(batch, batch_cnt, sizeof *batch, buffer_cache_sector_cmp);
+    for (size_t i = 0; i < batch_cnt; ) {
+        // Extend a run over blocks of adjacent sectors that are still
+        // dirty.  Only the first lock is waited for: blocking on a second
+        // one while holding the first could deadlock with a thread that
+        // holds one index block while getting another.
+        size_t n = 0;
+        lock_acquire(&batch[i]->lock);
+        do {
+            if (!batch[i + n]->dirty || batch[i + n]->journaled || batch[i + n]->delayed) {
+                lock_release(&batch[i + n]->lock);
+                break;
+            }
+            n++;
+        } while (i + n < batch_cnt && n < RANGE_BATCH
+                 && batch[i + n]->sector == batch[i + n - 1]->sector + 1
+                 && lock_try_acquire(&batch[i + n]->lock));
+        written += buffer_cache_write_run(batch + i, n);
+        i += n > 0 ? n : 1;
+    }
+
+    lock_acquire(&buffer_cache_lock);
+    cache_stats.cache_writebacks += written;
+    for (size_t i = 0; i < batch_cnt; i++) {
+        batch[i]->pin_cnt--;
+    }
+    lock_release(&buffer_cache_lock);
 }
 //-------------------------------------------------//
 /* buffer cache: block operation functions          */
 //-------------------------------------------------//
 
+/* Finds or loads SECTOR in the cache and returns its block pinned and
+   with the block's own lock held.  On a miss the sector is read from
+   disk only if FILL is true; otherwise the caller must overwrite the
+   whole buffer before releasing it.  Only the lookup and the choice of a
+   victim happen under buffer_cache_lock; the disk read for a miss is
+   done under the block's lock alone, so hits on other sectors proceed
+   in parallel with it. */
+static struct buffer_block *buffer_cache_acquire(block_sector_t sector, bool fill) {
+    lock_acquire(&buffer_cache_lock);
+    for (;;) {
+        // Check if the block we want is in the buffer cache
+        struct buffer_block *entry = buffer_cache_find(sector);
+        if (entry != NULL) {
+            // Cache hit: pin it, then wait for any I/O in progress on it
+            entry->pin_cnt++;
+            policy->access(entry);
+            entry->accessed = 1;
+            cache_stats.cache_hits++;
+            if (entry->prefetched) {
+                entry->prefetched = 0;
+                cache_stats.cache_read_ahead_hits++;
+            }
+            lock_release(&buffer_cache_lock);
+            lock_acquire(&entry->lock);
+            return entry;
+        }
+
+        // Cache miss: the block was not found so we need to evict
+        //printf("   (buffer_cache_acquire) cache miss\n");
+        bool all_pinned;
+        entry = buffer_cache_evict(&all_pinned);
+        if (entry == NULL) {
+            if (all_pinned) {
+                // Let the holders finish
+                lock_release(&buffer_cache_lock);
+                thread_yield();
+                lock_acquire(&buffer_cache_lock);
+            }
+            continue;
+        }
+        buffer_cache_claim(entry, sector);
+        cache_stats.cache_misses++;
+        lock_release(&buffer_cache_lock);
+
+        // Initialize the buffer cache block
+        if (fill) {
+            block_read(fs_device, sector, entry->buf);
+        }
+        return entry;
+    }
+}
+
+/* Releases a block obtained from buffer_cache_acquire(), marking it
+   dirty on behalf of the file whose inode is at OWNER first if DIRTY is
+   true, as metadata if META is. */
+static void buffer_cache_release(struct buffer_block *entry, bool dirty, block_sector_t owner, bool meta) {
+    if (dirty) {
+        buffer_cache_mark_dirty(entry, owner, meta);
+    }
+    lock_release(&entry->lock);
+    lock_acquire(&buffer_cache_lock);
+    entry->pin_cnt--;
+    lock_release(&buffer_cache_lock);
+}
+
+/* Marks ENTRY dirty, starting its write-behind clock unless it already
+   was, and records OWNER as the inode it belongs to for
+   buffer_cache_sync().  A block of metadata (META) is offered to the
+   journal, which holds it pinned and unwritten until the transaction
+   changing it commits.  The caller must hold the block's lock. */
+static void buffer_cache_mark_dirty(struct buffer_block *entry, block_sector_t owner, bool meta) {
+    entry->owner = owner;
+    if (!entry->dirty) {
+        entry->dirty = 1;
+        entry->dirty_since = timer_ticks();
+    }
+    if (meta && !entry->journaled) {
+        lock_acquire(&buffer_cache_lock);
+        if (journal_dirty(entry)) {
+            entry->journaled = 1;
+            entry->pin_cnt++;
+            held_cnt++;
+            ASSERT(held_cnt <= JOURNAL_TXN_MAX);
+        }
+        lock_release(&buffer_cache_lock);
+    }
+}
+
+/* Copies SIZE bytes between DATA and the byte range that starts
+   SECTOR_OFS bytes into SECTORS[0] and runs on through SECTORS[1],
+   SECTORS[2], ..., as many of the CNT sectors as it covers: into DATA
+   if WRITE is false, out of it if true.  A null DATA with WRITE false
+   only loads the sectors.  Blocks written are dirtied on behalf of the
+   file whose inode is at OWNER, as metadata if META is true.  Transfers
+   at most RANGE_BATCH sectors and
+   returns how many it did, possibly fewer if the cache is short of
+   unpinned blocks; the caller loops over the rest.
+
+   All the blocks are looked up and pinned under one acquisition of
+   buffer_cache_lock.  Misses on adjacent sectors are then read with a
+   single multi-sector device request, and misses that the write
+   covers completely are not read at all. */
+static size_t buffer_cache_transfer(const block_sector_t *sectors, size_t cnt, uint8_t *data,
+                                    int sector_ofs, size_t size, bool write, block_sector_t owner,
+                                    bool meta) {
+    struct buffer_block *batch[RANGE_BATCH];
+    bool missed[RANGE_BATCH];   // Claimed by us, its lock still held
+    bool fill[RANGE_BATCH];     // Missed and must be read from disk
+    void *buffers[RANGE_BATCH];
+    size_t n = 0;
+
+    ASSERT(sector_ofs >= 0 && sector_ofs < BLOCK_SECTOR_SIZE);
+    if (cnt > RANGE_BATCH) {
+        cnt = RANGE_BATCH;
+    }
+
+    // Pin every block of the batch, claiming victims for the misses
+    lock_acquire(&buffer_cache_lock);
+    while (n < cnt) {
+        struct buffer_block *entry = buffer_cache_find(sectors[n]);
+        if (entry != NULL) {
+            entry->pin_cnt++;
+            // Prefetching a block that is already there is no access
+            if (data != NULL) {
+                policy->access(entry);
+                entry->accessed = 1;
+                cache_stats.cache_hits++;
+                if (entry->prefetched) {
+                    entry->prefetched = 0;
+                    cache_stats.cache_read_ahead_hits++;
+                }
+            }
+            batch[n] = entry;
+            missed[n] = false;
+            n++;
+            continue;
+        }
+        bool all_pinned;
+        entry = buffer_cache_evict(&all_pinned);
+        if (entry == NULL) {
+            if (!all_pinned) {
+                continue;
+            }
+            // Waiting while we hold pins could deadlock with another
+            // batch, so settle for what we already have
+            if (n > 0) {
+                break;
+            }
+            lock_release(&buffer_cache_lock);
+            thread_yield();
+            lock_acquire(&buffer_cache_lock);
+            continue;
+        }
+        buffer_cache_claim(entry, sectors[n]);
+        if (data != NULL) {
+            cache_stats.cache_misses++;
+        } else {
+            entry->prefetched = 1;
+        }
+        batch[n] = entry;
+        missed[n] = true;
+        n++;
+    }
+    lock_release(&buffer_cache_lock);
+
+    // Work out which misses need their old contents
+    size_t left = size;
+    for (size_t i = 0; i < n; i++) {
+        int ofs = i == 0 ? sector_ofs : 0;
+        size_t len = (size_t) (BLOCK_SECTOR_SIZE - ofs) < left ? (size_t) (BLOCK_SECTOR_SIZE - ofs) : left;
+        fill[i] = missed[i] && !(write && ofs == 0 && len == BLOCK_SECTOR_SIZE);
+        left -= len;
+    }
+
+    // Read each run of adjacent misses with one device request
+    for (size_t i = 0; i < n; ) {
+        if (!fill[i]) {
+            i++;
+            continue;
+        }
+        size_t j = i;
+        do {
+            buffers[j - i] = batch[j]->buf;
+            j++;
+        } while (j < n && fill[j] && sectors[j] == sectors[j - 1] + 1);
+        block_readv(fs_device, sectors[i], j - i, buffers);
+        i = j;
+    }
+
+    // Copy the data.  The misses go first, so that no block lock of ours
+    // is held while we wait for the lock of a block someone else is using.
+    for (int pass = 0; pass < 2; pass++) {
+        left = size;
+        for (size_t i = 0; i < n; i++) {
+            int ofs = i == 0 ? sector_ofs : 0;
+            size_t len = (size_t) (BLOCK_SECTOR_SIZE - ofs) < left ? (size_t) (BLOCK_SECTOR_SIZE - ofs) : left;
+            uint8_t *chunk = data != NULL ? data + (size - left) : NULL;
+            left -= len;
+            if (missed[i] != (pass == 0)) {
+                continue;
+            }
+            if (data == NULL) {
+                // Just loading: hits are already there
+                if (missed[i]) {
+                    lock_release(&batch[i]->lock);
+                }
+                continue;
+            }
+            if (!missed[i]) {
+                lock_acquire(&batch[i]->lock);
+            }
+            if (write) {
+                memcpy(batch[i]->buf + ofs, chunk, len);
+                buffer_cache_mark_dirty(batch[i], owner, meta);
+            } else {
+                memcpy(chunk, batch[i]->buf + ofs, len);
+            }
+            lock_release(&batch[i]->lock);
+        }
+    }
+
+    lock_acquire(&buffer_cache_lock);
+    for (size_t i = 0; i < n; i++) {
+        batch[i]->pin_cnt--;
+    }
+    lock_release(&buffer_cache_lock);
+    return n;
+}
+
+/* Pin SECTOR in the cache and return its block, whose data the caller
+   may access in place through entry->buf until buffer_cache_put().
+   A thread must not get the same sector twice without putting it. */
+struct buffer_block *buffer_cache_get(block_sector_t sector) {
+    return buffer_cache_acquire(sector, true);
+}
+
+/* Like buffer_cache_get(), but for a freshly allocated sector whose old
+   contents don't matter: the block is zeroed instead of read from disk.
+   The caller must put it back dirty. */
+struct buffer_block *buffer_cache_get_zero(block_sector_t sector) {
+    struct buffer_block *entry = buffer_cache_acquire(sector, false);
+    memset(entry->buf, 0, BLOCK_SECTOR_SIZE);
+    return entry;
+}
+
+/* Unpin a block obtained from buffer_cache_get(), marking it dirty if
+   the caller modified it. */
+void buffer_cache_put(struct buffer_block *entry, bool dirty) {
+    buffer_cache_release(entry, dirty, CACHE_NO_OWNER, false);
+}
+
+/* Unpin a block obtained from buffer_cache_get() that the caller
+   modified on behalf of the file whose inode is at OWNER.  META tells
+   whether it holds metadata, such as an index block, for the journal. */
+void buffer_cache_put_owned(struct buffer_block *entry, block_sector_t owner, bool meta) {
+    buffer_cache_release(entry, true, owner, meta);
+}
+
+/* Unpin ENTRY, which the journal held until now, leaving it dirty so
+   that it is written back like any other block */
+void buffer_cache_unhold(struct buffer_block *entry) {
+    lock_acquire(&entry->lock);
+    ASSERT(entry->journaled);
+    entry->journaled = 0;
+    lock_release(&entry->lock);
+    lock_acquire(&buffer_cache_lock);
+    entry->pin_cnt--;
+    held_cnt--;
+    lock_release(&buffer_cache_lock);
+}
+
+/* Add a zero-filled block for the file whose inode is at OWNER, for
+   data not yet given a disk sector, and store the temporary sector
+   number it goes by until then into *TEMPP.  The block is dirty and
+   stays pinned and unwritten until buffer_cache_assign() or
+   buffer_cache_drop_temp().  Returns false if delayed blocks already
+   take their share of the cache. */
+bool buffer_cache_add_temp(block_sector_t owner, block_sector_t *tempp) {
+    block_sector_t temp;
+
+    lock_acquire(&buffer_cache_lock);
+    if (delayed_cnt >= cache_live_cnt / 4) {
+        lock_release(&buffer_cache_lock);
+        return false;
+    }
+    delayed_cnt++;
+    do {
+        temp = next_temp++;
+        if (next_temp == TEMP_LIMIT) {
+            next_temp = disk_size;
+        }
+    } while (buffer_cache_find(temp) != NULL);
+    lock_release(&buffer_cache_lock);
+
+    // The acquire pin is the one the block keeps
+    struct buffer_block *entry = buffer_cache_acquire(temp, false);
+    memset(entry->buf, 0, BLOCK_SECTOR_SIZE);
+    lock_acquire(&buffer_cache_lock);
+    entry->delayed = 1;
+    lock_release(&buffer_cache_lock);
+    buffer_cache_mark_dirty(entry, owner, false);
+    lock_release(&entry->lock);
+    *tempp = temp;
+    return true;
+}
+
+/* Re-keys the temporary block TEMP to SECTOR, just allocated for it,
+   and unpins it, dirty, to be written back like any other block.
+   Whatever the cache still holds of SECTOR's previous use is stale
+   and is thrown away.  The caller must keep TEMP's file from being
+   read or written meanwhile. */
+void buffer_cache_assign(block_sector_t temp, block_sector_t sector) {
+    lock_acquire(&buffer_cache_lock);
+    for (;;) {
+        struct buffer_block *stale = buffer_cache_find(sector);
+        if (stale == NULL) {
+            break;
+        }
+        // Only a commit could unpin a block the journal holds, and the
+        // caller's journal handle keeps one from happening.  The free
+        // map never hands out such a sector anyway.
+        ASSERT(!stale->journaled);
+        if (stale->pin_cnt > 0) {
+            // Someone is writing it back; let them finish
+            lock_release(&buffer_cache_lock);
+            thread_yield();
+            lock_acquire(&buffer_cache_lock);
+            continue;
+        }
+        policy->remove(stale);
+        hash_delete(&cache_index, &stale->hash_elem);
+        stale->sector = (block_sector_t) -1;
+        stale->dirty = 0;
+        policy->add(stale);
+    }
+    struct buffer_block *entry = buffer_cache_find(temp);
+    ASSERT(entry != NULL && entry->delayed);
+    policy->replace(entry, sector);
+    hash_delete(&cache_index, &entry->hash_elem);
+    entry->sector = sector;
+    hash_insert(&cache_index, &entry->hash_elem);
+    entry->delayed = 0;
+    entry->pin_cnt--;
+    delayed_cnt--;
+    lock_release(&buffer_cache_lock);
+}
+
+/* Throws away the temporary block TEMP, whose file was deleted before
+   the block got a sector */
+void buffer_cache_drop_temp(block_sector_t temp) {
+    lock_acquire(&buffer_cache_lock);
+    struct buffer_block *entry = buffer_cache_find(temp);
+    ASSERT(entry != NULL && entry->delayed);
+    policy->remove(entry);
+    hash_delete(&cache_index, &entry->hash_elem);
+    entry->sector = (block_sector_t) -1;
+    entry->dirty = 0;
+    entry->delayed = 0;
+    entry->pin_cnt--;
+    delayed_cnt--;
+    policy->add(entry);
+    lock_release(&buffer_cache_lock);
+}
+
 /* Read a block from the buffer cache or disk into a specified memory location. */
 void buffer_cache_read(block_sector_t sector, void *target, int sector_ofs, int chunk_size) {
-    lock_acquire(&buffer_cache_lock);
     // printf("(buffer_cache_read) attempting read sector: %d, offset: %d, size: %d\n", sector, sector_ofs, chunk_size);
-    // Check if the block we want is in the buffer cache
-    struct buffer_block *entry = buffer_cache_find(sector);
-    if (entry == NULL) {
-        // Cache miss: the block was not found so we need to evict based on LRU
-        //printf("   (buffer_cache_read) cache miss\n");
-        entry = buffer_cache_evict();
-        ASSERT(entry != NULL);
-        // Initialize the buffer cache block
-        block_read(fs_device, sector, entry->buf);
-        entry->sector = sector;
-        entry->dirty = 0;
-    } 
-    // Change the access and used flags of the buffer cache block
-    entry->used = 1;
-    entry->accessed = 1;
+    struct buffer_block *entry = buffer_cache_acquire(sector, true);
 
     // Perform the read operation
     memcpy(target, entry->buf + sector_ofs, chunk_size);
     //printf("(buffer_cache_read) finished\n");
-    lock_release(&buffer_cache_lock);
+    buffer_cache_release(entry, false, CACHE_NO_OWNER, false);
 }
 
-/* Write a block to the buffer cache */
-void buffer_cache_write(block_sector_t sector, const void *source, int sector_ofs, int chunk_size) {
-    lock_acquire(&buffer_cache_lock);  // Ensures exclusive access to the buffer cache.
+/* Write a block to the buffer cache on behalf of the file whose inode is at OWNER,
+   journaling it if it holds metadata (META) */
+void buffer_cache_write(block_sector_t sector, const void *source, int sector_ofs, int chunk_size,
+                        block_sector_t owner, bool meta) {
     // printf("(buffer_cache_write) attempting to write to sector: %d, offset: %d, size: %d\n", sector, sector_ofs, chunk_size);
-    struct buffer_block *entry = buffer_cache_find(sector);
-    if (entry == NULL) {
-        // Cache miss: need eviction
-        //printf("    (buffer_cache_write) cache miss\n");
-        entry = buffer_cache_evict();  // Evict a cache block if necessary.
-        ASSERT(entry != NULL);
-
-        // Read the sector data into the cache block only if necessary.
-        if (!entry->used || entry->sector != sector) {
-            block_read(fs_device, sector, entry->buf);  // Load the sector data into the cache.
-            entry->sector = sector;
-            entry->dirty = 0;  // Initially not dirty because we just loaded it.
-        }
-    } 
-
-    // Mark the entry as used, accessed, and dirty since it's being modified.
-    entry->used = 1;
-    entry->accessed = 1;
-    entry->dirty = 1;
+    // A miss on a sector we overwrite completely needn't be read first
+    bool whole = sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE;
+    struct buffer_block *entry = buffer_cache_acquire(sector, !whole);
 
     // Perform the write operation to the buffer, not the disk.
     memcpy(entry->buf + sector_ofs, source, chunk_size);
     //printf("(buffer_cache_write) finished\n");
-    lock_release(&buffer_cache_lock);  // Release the lock after the operation.
+    // Mark the entry dirty since it's being modified.
+    buffer_cache_release(entry, true, owner, meta);
+}
+
+/* Read SIZE bytes starting SECTOR_OFS bytes into SECTORS[0] and running
+   on through the following sectors of the list, which must cover them,
+   into TARGET.  Looks the blocks up in batches and reads misses on
+   adjacent sectors from disk together. */
+void buffer_cache_read_range(const block_sector_t *sectors, void *target, int sector_ofs, size_t size) {
+    uint8_t *data = target;
+    while (size > 0) {
+        size_t cnt = DIV_ROUND_UP(sector_ofs + size, BLOCK_SECTOR_SIZE);
+        size_t done = buffer_cache_transfer(sectors, cnt, data, sector_ofs, size, false, CACHE_NO_OWNER,
+                                            false);
+        size_t bytes = done * BLOCK_SECTOR_SIZE - sector_ofs;
+        if (bytes > size) {
+            bytes = size;
+        }
+        sectors += done;
+        data += bytes;
+        size -= bytes;
+        sector_ofs = 0;
+    }
+}
+
+/* Write SIZE bytes from SOURCE into the cache, starting SECTOR_OFS bytes
+   into SECTORS[0] and running on through the following sectors of the
+   list, on behalf of the file whose inode is at OWNER, as metadata if META
+   is true.  Sectors that are overwritten completely are never read from
+   disk. */
+void buffer_cache_write_range(const block_sector_t *sectors, const void *source, int sector_ofs, size_t size,
+                              block_sector_t owner, bool meta) {
+    uint8_t *data = (uint8_t *) source;
+    while (size > 0) {
+        size_t cnt = DIV_ROUND_UP(sector_ofs + size, BLOCK_SECTOR_SIZE);
+        size_t done = buffer_cache_transfer(sectors, cnt, data, sector_ofs, size, true, owner, meta);
+        size_t bytes = done * BLOCK_SECTOR_SIZE - sector_ofs;
+        if (bytes > size) {
+            bytes = size;
+        }
+        sectors += done;
+        data += bytes;
+        size -= bytes;
+        sector_ofs = 0;
+    }
+}
+
+/* Ask the read-ahead thread to load SECTOR into the cache.  Returns
+   immediately; the request is dropped if the queue is full. */
+void buffer_cache_read_ahead(block_sector_t sector) {
+    // A temporary block is always in the cache, and may be gone from
+    // it by the time the request is served
+    if (sector >= disk_size) {
+        return;
+    }
+    lock_acquire(&read_ahead_lock);
+    if (read_ahead_cnt < READ_AHEAD_QUEUE) {
+        read_ahead_queue[(read_ahead_head + read_ahead_cnt) % READ_AHEAD_QUEUE] = sector;
+        read_ahead_cnt++;
+        cond_signal(&read_ahead_cond, &read_ahead_lock);
+    }
+    lock_release(&read_ahead_lock);
 }
 
-/* Flush all dirty blocks to disk */
-static void buffer_cache_flush(struct buffer_block *entry) {
-    //ASSERT(lock_held_by_current_thread(&buffer_cache_lock));
-    if (entry->dirty) {
+/* Copy the cache counters into the cache_* members of *STATS */
+void buffer_cache_get_stats(struct fsstat *stats) {
+    lock_acquire(&buffer_cache_lock);
+    stats->cache_hits = cache_stats.cache_hits;
+    stats->cache_misses = cache_stats.cache_misses;
+    stats->cache_evictions = cache_stats.cache_evictions;
+    stats->cache_dirty_evictions = cache_stats.cache_dirty_evictions;
+    stats->cache_writebacks = cache_stats.cache_writebacks;
+    stats->cache_read_ahead_hits = cache_stats.cache_read_ahead_hits;
+    lock_release(&buffer_cache_lock);
+}
+
+/* Print the cache counters, at shutdown */
+void buffer_cache_print_stats(void) {
+    // Don't take the lock: we may be shutting down from a panic
+    printf("Buffer cache: %llu hits, %llu misses, %llu evictions (%llu dirty), "
+           "%llu write-backs, %llu read-ahead hits\n",
+           cache_stats.cache_hits, cache_stats.cache_misses,
+           cache_stats.cache_evictions, cache_stats.cache_dirty_evictions,
+           cache_stats.cache_writebacks, cache_stats.cache_read_ahead_hits);
+}
+
+/* Write a block back to disk if it is dirty, the journal doesn't hold
+   it and it has a sector, returning true if it was written.  The caller
+   must hold the block's lock. */
+static bool buffer_cache_flush(struct buffer_block *entry) {
+    ASSERT(lock_held_by_current_thread(&entry->lock));
+    if (entry->dirty && !entry->journaled && !entry->delayed) {
         block_write(fs_device, entry->sector, entry->buf);
         entry->dirty = 0;
+        return true;
     }
+    return false;
 }
-
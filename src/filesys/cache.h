@@ -4,34 +4,87 @@
 #include <stdint.h>
 #include "devices/block.h" /* Include this header for block_sector_t */
 #include "lib/kernel/list.h" /* Include Pintos list header */
+#include "lib/kernel/hash.h" /* Include Pintos hash header */
 #include "threads/synch.h"
+#include <fsstat.h>
 
 struct buffer_block {
     int dirty;          /* flag for knowing if the block has been changed */
-    int used;           /* flag for knowing if the block has been used yet */
+    int used;           /* reference bit for the clock replacement policy */
     int accessed;       /* flag for knowing if the block has been accessed recently */
+    int prefetched;     /* loaded by read-ahead and not accessed since */
+    int pin_cnt;        /* number of threads using the block; pinned blocks are never evicted */
+    int journaled;      /* held by the running journal transaction: pinned, and not written back until it commits */
+    int delayed;        /* data of a file block with no disk sector yet, keyed by a temporary sector number: pinned, and never written back */
+    int64_t dirty_since;    /* timer tick at which the block last became dirty */
     block_sector_t sector;  /* on-disk location (sector number) of the block */
-    void *vaddr;  /* virtual address of the associated buffer cache entry */
+    block_sector_t owner;   /* inode sector of the file that last dirtied the block, or CACHE_NO_OWNER */
+    struct lock lock;   /* serializes access to buf, including disk I/O on it */
     struct list_elem elem;  /* List element for inclusion in cache_list */
-    uint8_t buf[BLOCK_SECTOR_SIZE];
+    struct list_elem policy_elem;  /* List element owned by the replacement policy */
+    int queue;          /* which of the replacement policy's lists holds the block */
+    struct hash_elem hash_elem;  /* Hash element for the sector index */
+    uint8_t *buf;       /* BLOCK_SECTOR_SIZE bytes of data, in a page shared with neighbouring entries */
 };
 
+/* Owner of blocks dirtied outside any one file */
+#define CACHE_NO_OWNER ((block_sector_t) -1)
+
 /* Declare the global cache list */
 struct list cache_list;
 
-/* A lock for synchronizing buffer cache operations. */
-static struct lock buffer_cache_lock;
+/* Number of sectors to cache (0 for a RAM-proportional default), set from the kernel command line */
+extern int cache_size;
+/* Write-behind tunables in milliseconds, set from the kernel command line */
+extern int cache_flush_interval;
+extern int cache_dirty_age;
 
 /* Function to initialize the buffer cache */
 void buffer_cache_init(void);
+/* Start the background write-behind thread */
+void buffer_cache_start_flusher(void);
+/* Start the background read-ahead thread */
+void buffer_cache_start_read_ahead(void);
 
 
-/* Helper function to find a buffer block in the cache */
+/* Helper function to find a buffer block in the cache (cache lock held) */
 struct buffer_block *buffer_cache_find(block_sector_t sector);
+/* Pin a block in the cache for in-place access through entry->buf */
+struct buffer_block *buffer_cache_get(block_sector_t sector);
+/* Pin a newly allocated block, zero-filled instead of read from disk */
+struct buffer_block *buffer_cache_get_zero(block_sector_t sector);
+/* Unpin a block obtained from buffer_cache_get(), marking it dirty if changed */
+void buffer_cache_put(struct buffer_block *entry, bool dirty);
+/* Unpin a block changed on behalf of the file whose inode is at owner, journaling it if meta */
+void buffer_cache_put_owned(struct buffer_block *entry, block_sector_t owner, bool meta);
+/* Let go of a block the journal held, once its transaction is in the log */
+void buffer_cache_unhold(struct buffer_block *entry);
+/* Add a zeroed block for the file whose inode is at owner under a new temporary sector number */
+bool buffer_cache_add_temp(block_sector_t owner, block_sector_t *tempp);
+/* Move a temporary block to the disk sector allocated for it, dirty */
+void buffer_cache_assign(block_sector_t temp, block_sector_t sector);
+/* Discard a temporary block whose file is gone */
+void buffer_cache_drop_temp(block_sector_t temp);
 /* Read a block from the buffer cache or disk */
 void buffer_cache_read(block_sector_t sector, void *target, int sector_ofs, int chunk_size);
 /* Write a block to the buffer cache */
-void buffer_cache_write(block_sector_t sector, const void *source, int sector_ofs, int chunk_size);
+void buffer_cache_write(block_sector_t sector, const void *source, int sector_ofs, int chunk_size,
+                        block_sector_t owner, bool meta);
+/* Read a byte range spanning the listed sectors, batching lookups and disk reads */
+void buffer_cache_read_range(const block_sector_t *sectors, void *target, int sector_ofs, size_t size);
+/* Write a byte range spanning the listed sectors, skipping reads of fully overwritten ones */
+void buffer_cache_write_range(const block_sector_t *sectors, const void *source, int sector_ofs, size_t size,
+                              block_sector_t owner, bool meta);
+/* Queue a sector to be loaded into the cache in the background */
+void buffer_cache_read_ahead(block_sector_t sector);
+/* Copy the cache counters into *stats */
+void buffer_cache_get_stats(struct fsstat *stats);
+/* Print the cache counters at shutdown */
+void buffer_cache_print_stats(void);
+/* Write back the dirty blocks of the file whose inode is at owner */
+void buffer_cache_sync(block_sector_t owner);
+/* Write every dirty block back to disk, except those the journal holds */
+void buffer_cache_flush_all(void);
 /* Close the buffer cache, flushing all dirty entries to disk. this is a write-back method */
 void buffer_cache_close(void);
 #endif /* filesys/cache.h */
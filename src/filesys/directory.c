@@ -1,9 +1,13 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <round.h>
 #include <list.h>
+#include <hash.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "filesys/name-cache.h"
 #include "threads/malloc.h"
 #include "threads/thread.h"
 #include "filesys/cache.h"
@@ -18,14 +22,260 @@ struct dir
     off_t pos;                          /**< Current position. */
 };
 
-/** A single directory entry. */
+/** A single directory entry.
+    Padded to 32 bytes so that a sector holds a whole number of
+    entries and directories can be scanned in place in the buffer
+    cache.
+
+    Every directory starts with "." and "..".  A small directory is
+    linear: the rest of its entries follow in no particular order.
+    Once it outgrows DIR_INDEX_THRESHOLD entries it is rebuilt as an
+    indexed directory, whose first sector holds only "." and ".."
+    and is followed by a hash table of SLOT_CNT entries, found by
+    linear probing from hash_string() of the name.  A removed entry
+    keeps its name as a tombstone so that probes continue past it; a
+    slot that was never used has an empty name and ends the probe.
+    The table is rebuilt, twice as big, before it gets 3/4 full.
+    A rebuild is one journal transaction, so it waits for an addition
+    that finds the transaction with room for it, and a table too big
+    to rebuild in any fills up instead of growing. */
 struct dir_entry 
 {
     block_sector_t inode_sector;        /**< Sector number of header. */
     char name[NAME_MAX + 1];            /**< Null terminated file name. */
     bool in_use;                        /**< In use or free? */
+    /* Only meaningful in the "." entry. */
+    uint32_t slot_cnt;                  /**< Hash slots, 0 if linear. */
+    uint32_t used_cnt;                  /**< Slots in use or tombstones. */
+    uint8_t unused[4];                  /**< Pads the entry to 32 bytes. */
 };
 
+/** Linear directories with more entries than this get indexed. */
+#define DIR_INDEX_THRESHOLD 64
+/** Fewest slots in an indexed directory.  Must be a power of 2 and
+    a multiple of the entries per sector. */
+#define DIR_INDEX_MIN_SLOTS 128
+/** Offset of the first slot of an indexed directory. */
+#define DIR_SLOTS_OFS BLOCK_SECTOR_SIZE
+/** Most blocks of a journal transaction dir_add() dirties, short of
+    a rebuild: the directory's inode, its header and entry sectors and
+    up to 3 index blocks for a new entry sector. */
+#define DIR_ADD_CREDITS 6
+
+/** Decides whether dir_scan() should stop at entry E. */
+typedef bool dir_match_func (const struct dir_entry *e, const void *aux);
+
+/** Scans DIR's entries in place in the buffer cache, starting at byte
+    offset *OFSP, for one that MATCH accepts.  If one is found, copies
+    it to *EP if EP is non-null, sets *OFSP to its offset and returns
+    true.  Otherwise sets *OFSP to the offset just past the last entry
+    and returns false. */
+static bool
+dir_scan (const struct dir *dir, off_t *ofsp, dir_match_func *match,
+          const void *aux, struct dir_entry *ep)
+{
+    off_t length = inode_length(dir->inode);
+    off_t ofs = *ofsp;
+
+    ASSERT (BLOCK_SECTOR_SIZE % sizeof (struct dir_entry) == 0);
+    ASSERT (ofs % sizeof (struct dir_entry) == 0);
+
+    // Inline entries live in the in-memory inode: read them one by one
+    if (inode_is_inline(dir->inode)) {
+        struct dir_entry e;
+        for (; ofs + (off_t) sizeof e <= length; ofs += sizeof e) {
+            if (inode_read_at(dir->inode, &e, sizeof e, ofs) == sizeof e && match(&e, aux)) {
+                if (ep != NULL) {
+                    *ep = e;
+                }
+                *ofsp = ofs;
+                return true;
+            }
+        }
+        *ofsp = ofs;
+        return false;
+    }
+
+    while (ofs + (off_t) sizeof (struct dir_entry) <= length) {
+        // A hole holds nothing but free entries
+        static const struct dir_entry hole_entry;
+        block_sector_t sector = inode_get_sector(dir->inode, ofs);
+        struct buffer_block *block = sector != 0 ? buffer_cache_get(sector) : NULL;
+        off_t sector_end = ofs - ofs % BLOCK_SECTOR_SIZE + BLOCK_SECTOR_SIZE;
+        for (; ofs < sector_end && ofs + (off_t) sizeof (struct dir_entry) <= length;
+             ofs += sizeof (struct dir_entry)) {
+            const struct dir_entry *e = block == NULL ? &hole_entry
+                : (const struct dir_entry *) (block->buf + ofs % BLOCK_SECTOR_SIZE);
+            if (match(e, aux)) {
+                if (ep != NULL) {
+                    *ep = *e;
+                }
+                if (block != NULL) {
+                    buffer_cache_put(block, false);
+                }
+                *ofsp = ofs;
+                return true;
+            }
+        }
+        if (block != NULL) {
+            buffer_cache_put(block, false);
+        }
+    }
+    *ofsp = ofs;
+    return false;
+}
+
+/** dir_scan() matcher for the in-use entry named AUX. */
+static bool
+match_name (const struct dir_entry *e, const void *name)
+{
+    return e->in_use && !strcmp(name, e->name);
+}
+
+/** dir_scan() matcher for a free slot. */
+static bool
+match_free (const struct dir_entry *e, const void *aux UNUSED)
+{
+    return !e->in_use;
+}
+
+/** dir_scan() matcher for an in-use entry other than "." and "..". */
+static bool
+match_listed (const struct dir_entry *e, const void *aux UNUSED)
+{
+    return e->in_use && strcmp(e->name, ".") != 0 && strcmp(e->name, "..") != 0;
+}
+
+/** dir_scan() matcher that ends a probe for the name AUX: its entry,
+    or a slot that was never used. */
+static bool
+match_probe (const struct dir_entry *e, const void *name)
+{
+    return (e->in_use && !strcmp(name, e->name)) || e->name[0] == '\0';
+}
+
+/** Reads DIR's "." entry, which says how DIR is laid out, into *HDR. */
+static void
+read_header (const struct dir *dir, struct dir_entry *hdr)
+{
+    if (inode_read_at(dir->inode, hdr, sizeof *hdr, 0) != sizeof *hdr) {
+        memset(hdr, 0, sizeof *hdr);
+    }
+}
+
+/** Writes HDR back as DIR's "." entry. */
+static bool
+write_header (struct dir *dir, const struct dir_entry *hdr)
+{
+    return inode_write_at(dir->inode, hdr, sizeof *hdr, 0) == sizeof *hdr;
+}
+
+/** Scans the slots of indexed directory DIR, whose header is HDR, in
+    probe order for NAME, wrapping around at the end of the table, for
+    an entry that MATCH accepts.  Otherwise like dir_scan(). */
+static bool
+index_scan (const struct dir *dir, const struct dir_entry *hdr, const char *name,
+            dir_match_func *match, const void *aux, struct dir_entry *ep, off_t *ofsp)
+{
+    off_t end = DIR_SLOTS_OFS + (off_t) hdr->slot_cnt * sizeof (struct dir_entry);
+    off_t ofs = DIR_SLOTS_OFS
+                + (off_t) (hash_string(name) & (hdr->slot_cnt - 1)) * sizeof (struct dir_entry);
+
+    // Past END there can only be unused slots left by a failed rebuild
+    if (!dir_scan(dir, &ofs, match, aux, ep) || ofs >= end) {
+        ofs = DIR_SLOTS_OFS;
+        if (!dir_scan(dir, &ofs, match, aux, ep) || ofs >= end) {
+            return false;
+        }
+    }
+    *ofsp = ofs;
+    return true;
+}
+
+/** Returns the number of slots an index for ENTRY_CNT entries gets. */
+static uint32_t
+index_slot_cnt (size_t entry_cnt)
+{
+    uint32_t slot_cnt = DIR_INDEX_MIN_SLOTS;
+    while (slot_cnt < 2 * (entry_cnt + 1)) {
+        slot_cnt *= 2;
+    }
+    return slot_cnt;
+}
+
+/** Returns the most blocks of a journal transaction that rebuilding
+    the index of a directory LENGTH bytes long, for ENTRY_CNT entries,
+    dirties: every sector of the new layout or the old, whichever is
+    longer, up to 3 index blocks and the inode. */
+static size_t
+index_credits (off_t length, size_t entry_cnt)
+{
+    off_t new_length = DIR_SLOTS_OFS
+                       + (off_t) index_slot_cnt(entry_cnt) * sizeof (struct dir_entry);
+    if (new_length < length) {
+        new_length = length;
+    }
+    return DIV_ROUND_UP(new_length, BLOCK_SECTOR_SIZE) + 3 + 1;
+}
+
+/** Rebuilds DIR as an indexed directory with at least twice as many
+    slots as it has entries, and updates *HDR to match.  Works on
+    linear and indexed directories alike.  Returns false, leaving DIR
+    as it was, if memory or disk space runs out or if the running
+    journal transaction hasn't room for the rebuild. */
+static bool
+dir_index (struct dir *dir, struct dir_entry *hdr)
+{
+    static const char zeros[BLOCK_SECTOR_SIZE];
+    off_t length = inode_length(dir->inode);
+    struct dir_entry *entries = malloc(length);
+    size_t cnt = 0, i;
+    uint32_t slot_cnt;
+    off_t new_length, ofs;
+
+    if (entries == NULL) {
+        return false;
+    }
+    ofs = 0;
+    while (dir_scan(dir, &ofs, match_listed, NULL, &entries[cnt])) {
+        cnt++;
+        ofs += sizeof (struct dir_entry);
+    }
+    if (!journal_extend(index_credits(length, cnt))) {
+        free(entries);
+        return false;
+    }
+    slot_cnt = index_slot_cnt(cnt);
+    new_length = DIR_SLOTS_OFS + (off_t) slot_cnt * sizeof (struct dir_entry);
+
+    // Allocate every sector of the new layout first, so that nothing
+    // later can fail halfway through
+    for (ofs = 0; ofs < new_length; ofs += BLOCK_SECTOR_SIZE) {
+        if ((ofs >= length || inode_get_sector(dir->inode, ofs) == 0)
+            && inode_write_at(dir->inode, zeros, BLOCK_SECTOR_SIZE, ofs) != BLOCK_SECTOR_SIZE) {
+            free(entries);
+            return false;
+        }
+    }
+
+    // Clear everything but "." and "..", then hash the entries back in
+    for (ofs = 2 * sizeof (struct dir_entry); ofs < length; ) {
+        off_t chunk = BLOCK_SECTOR_SIZE - ofs % BLOCK_SECTOR_SIZE;
+        inode_write_at(dir->inode, zeros, chunk, ofs);
+        ofs += chunk;
+    }
+    hdr->slot_cnt = slot_cnt;
+    hdr->used_cnt = cnt;
+    write_header(dir, hdr);
+    for (i = 0; i < cnt; i++) {
+        struct dir_entry slot;
+        index_scan(dir, hdr, entries[i].name, match_free, NULL, &slot, &ofs);
+        inode_write_at(dir->inode, &entries[i], sizeof entries[i], ofs);
+    }
+    free(entries);
+    return true;
+}
+
 /** Creates a directory with space for ENTRY_CNT entries in the
     given SECTOR.  Returns true if successful, false on failure. */
 bool
@@ -63,11 +313,27 @@ dir_create (block_sector_t sector, size_t entry_cnt)
     // Close the directory
     dir_close(dir);
 
-    buffer_cache_close();
-
     return true;  // Return true if directory creation and entries creation were successful
 }
 
+/** Returns true if the file system's directories have the current
+    on-disk format, in which the root directory's ".." is its second
+    32-byte entry.  Images from before entries were padded have
+    20-byte ones, so the same offset falls in the middle of "..". */
+bool
+dir_format_ok (void)
+{
+    struct inode *inode = inode_open(ROOT_DIR_SECTOR);
+    struct dir_entry e;
+    bool ok = (inode != NULL
+               && inode_read_at(inode, &e, sizeof e, sizeof e) == sizeof e
+               && e.in_use && !strcmp(e.name, "..")
+               && e.inode_sector == ROOT_DIR_SECTOR);
+
+    inode_close(inode);
+    return ok;
+}
+
 /** Opens and returns the directory for the given INODE, of which
     it takes ownership.  Returns a null pointer on failure. */
 struct dir *
@@ -131,45 +397,67 @@ static bool
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
-    struct dir_entry e;
-    size_t ofs;
+    struct dir_entry hdr, e;
+    off_t ofs = 0;
 
     ASSERT (dir != NULL);
     ASSERT (name != NULL);
 
-    for (ofs = 0; inode_read_at(dir->inode, &e, sizeof e, ofs) == sizeof e;
-         ofs += sizeof e) {
-        if (e.in_use && !strcmp(name, e.name)) {
-            if (ep != NULL) {
-                *ep = e;
-            }
-            if (ofsp != NULL) {
-                *ofsp = ofs;
-            }
-            return true;
+    read_header(dir, &hdr);
+    if (hdr.slot_cnt == 0) {
+        if (!dir_scan(dir, &ofs, match_name, name, &e)) {
+            return false;
         }
+    } else if (!strcmp(name, ".") || !strcmp(name, "..")) {
+        // These two stay in the first sector, outside the table
+        ofs = name[1] == '\0' ? 0 : sizeof e;
+        if (inode_read_at(dir->inode, &e, sizeof e, ofs) != sizeof e || !e.in_use) {
+            return false;
+        }
+    } else if (!index_scan(dir, &hdr, name, match_probe, name, &e, &ofs) || !e.in_use) {
+        return false;
     }
-    return false;
+
+    if (ep != NULL) {
+        *ep = e;
+    }
+    if (ofsp != NULL) {
+        *ofsp = ofs;
+    }
+    return true;
 }
 
 /** Searches DIR for a file with the given NAME
     and returns true if one exists, false otherwise.
     On success, sets *INODE to an inode for the file, otherwise to
-    a null pointer.  The caller must close *INODE. */
+    a null pointer.  The caller must close *INODE.
+    Answers, negative ones included, come from the name cache when
+    it has them.  The inode is opened under DIR's lock either way,
+    so that it can't be removed and freed in between. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
     struct dir_entry e;
+    block_sector_t dir_sector, sector;
 
     ASSERT (dir != NULL);
     ASSERT (name != NULL);
 
-    if (lookup(dir, name, &e, NULL)){
-        *inode = inode_open(e.inode_sector);
-    } else {
-        *inode = NULL;
+    dir_sector = inode_get_inumber(dir->inode);
+    inode_dir_lock(dir->inode);
+    if (!name_cache_lookup(dir_sector, name, &sector)) {
+        // Cache the answer before any change to DIR can outdate it,
+        // unless DIR is removed: its names were purged for good, since
+        // its sector may go to a new directory
+        sector = lookup(dir, name, &e, NULL) ? e.inode_sector : NAME_CACHE_ABSENT;
+        if (!inode_is_removed(dir->inode)) {
+            name_cache_insert(dir_sector, name, sector);
+        }
     }
+    // Open it before a removal from DIR can free the sector for reuse
+    *inode = sector != NAME_CACHE_ABSENT ? inode_open(sector) : NULL;
+    inode_dir_unlock(dir->inode);
 
     return *inode != NULL;
 }
@@ -182,7 +470,7 @@ dir_lookup (const struct dir *dir, const char *name,
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector, int is_dir)
 {
-    struct dir_entry e;
+    struct dir_entry e, hdr;
     off_t ofs;
     bool success = false;
 
@@ -195,32 +483,23 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector, int is_
         return false;
     }
 
-    /* Check that NAME is not in use. */
-    if (lookup(dir, name, NULL, NULL)) {
-        debug_printf("(dir_add) Name already in use: %s\n", name);
-        goto done;
-    }
+    inode_dir_lock(dir->inode);
 
-    /* Set OFS to offset of free slot.
-       If there are no free slots, then it will be set to the
-       current end-of-file. */
-    for (ofs = 0; inode_read_at(dir->inode, &e, sizeof e, ofs) == sizeof e;
-         ofs += sizeof e) 
-    {
-        if (!e.in_use)
-            break;
+    /* Check that DIR is still there and NAME is not in use. */
+    if (inode_is_removed(dir->inode)) {
+        debug_printf("(dir_add) Directory has been removed\n");
+        goto done;
     }
-
-    /* Write slot. */
-    e.in_use = true;
-    strlcpy(e.name, name, sizeof e.name);
-    e.inode_sector = inode_sector;
-    if (inode_write_at(dir->inode, &e, sizeof e, ofs) != sizeof e) {
-        debug_printf("(dir_add) Failed to write directory entry\n");
+    if (lookup(dir, name, NULL, NULL)) {
+        debug_printf("(dir_add) Name already in use: %s\n", name);
         goto done;
     }
 
+    /* Give a new directory its "." and ".." before anyone can find
+       it through DIR, and forget any names still cached for a removed
+       directory that had its sector. */
     if (is_dir) {
+        name_cache_purge_dir(inode_sector);
         struct dir *sub_dir = dir_open(inode_open(inode_sector));
         if (sub_dir == NULL) {
             debug_printf("(dir_add) Failed to open sub directory\n");
@@ -229,6 +508,7 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector, int is_
 
         /* Add "." entry */
         struct dir_entry dot;
+        memset(&dot, 0, sizeof dot);
         dot.in_use = true;
         strlcpy(dot.name, ".", sizeof dot.name);
         dot.inode_sector = inode_sector;
@@ -240,6 +520,7 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector, int is_
 
         /* Add ".." entry */
         struct dir_entry dot_dot;
+        memset(&dot_dot, 0, sizeof dot_dot);
         dot_dot.in_use = true;
         strlcpy(dot_dot.name, "..", sizeof dot_dot.name);
         dot_dot.inode_sector = inode_get_inumber(dir->inode);
@@ -252,31 +533,89 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector, int is_
         dir_close(sub_dir);
     }
 
+    /* Set OFS to offset of free slot.
+       In a linear directory with no free slots, it will be set to
+       the current end-of-file, unless the directory is big enough
+       to be worth indexing. */
+    read_header(dir, &hdr);
+    if (hdr.slot_cnt == 0) {
+        ofs = 0;
+        dir_scan(dir, &ofs, match_free, NULL, NULL);
+        // Should indexing fail, the entry goes at OFS all the same
+        if (ofs >= (off_t) (DIR_INDEX_THRESHOLD * sizeof e) && !dir_index(dir, &hdr)) {
+            debug_printf("(dir_add) Failed to index directory\n");
+        }
+    } else if ((hdr.used_cnt + 1) * 4 > hdr.slot_cnt * 3 && !dir_index(dir, &hdr)
+               && hdr.used_cnt + 2 > hdr.slot_cnt) {
+        // Keep a slot that was never used, to end probes
+        debug_printf("(dir_add) Failed to grow directory index\n");
+        goto done;
+    }
+    if (hdr.slot_cnt != 0) {
+        /* The first tombstone or unused slot on NAME's probe path. */
+        index_scan(dir, &hdr, name, match_free, NULL, &e, &ofs);
+        if (e.name[0] == '\0') {
+            hdr.used_cnt++;
+            if (!write_header(dir, &hdr)) {
+                goto done;
+            }
+        }
+    }
+
+    /* Write slot. */
+    memset(&e, 0, sizeof e);
+    e.in_use = true;
+    strlcpy(e.name, name, sizeof e.name);
+    e.inode_sector = inode_sector;
+    if (inode_write_at(dir->inode, &e, sizeof e, ofs) != sizeof e) {
+        debug_printf("(dir_add) Failed to write directory entry\n");
+        goto done;
+    }
+    name_cache_insert(inode_get_inumber(dir->inode), name, inode_sector);
+
     success = true;
 
 done:
+    inode_dir_unlock(dir->inode);
     if (!success) {
         debug_printf("(dir_add) Failed to add entry: %s\n", name);
     }
     return success;
 }
 
+/** Returns the most blocks of a journal transaction adding an entry
+    to DIR may dirty, including a rebuild of its index if the next
+    addition looks due for one.  Reads DIR without its lock, so this
+    is only a guess, which dir_add() makes up for with
+    journal_extend() if need be. */
+size_t
+dir_add_credits (struct dir *dir)
+{
+    struct dir_entry hdr;
+    off_t length = inode_length(dir->inode);
+
+    read_header(dir, &hdr);
+    if (hdr.slot_cnt == 0 && length >= (off_t) (DIR_INDEX_THRESHOLD * sizeof hdr)) {
+        return DIR_ADD_CREDITS + index_credits(length, length / sizeof hdr);
+    }
+    if (hdr.slot_cnt != 0 && (hdr.used_cnt + 1) * 4 > hdr.slot_cnt * 3) {
+        return DIR_ADD_CREDITS + index_credits(length, hdr.used_cnt);
+    }
+    return DIR_ADD_CREDITS;
+}
 
 /* SUpport function for dir_remove()*/
 bool
 dir_is_empty (struct dir *dir) 
 {
   struct dir_entry e;
-  off_t ofs;
+  off_t ofs = 0;
 
   ASSERT (dir != NULL);
 
-  for (ofs = 0; inode_read_at(dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) {
-    if (e.in_use && strcmp(e.name, ".") != 0 && strcmp(e.name, "..") != 0) {
-      printf("Directory not empty: %s\n", e.name);
-      return false;
-    }
+  if (dir_scan(dir, &ofs, match_listed, NULL, &e)) {
+    printf("Directory not empty: %s\n", e.name);
+    return false;
   }
   return true;
 }
@@ -289,50 +628,60 @@ dir_remove (struct dir *dir, const char *name)
   struct dir_entry e;  // Directory entry to store the found entry
   struct inode *inode = NULL;  // Inode corresponding to the directory entry
   bool success = false;  
+  bool child_locked = false;
+  bool empty;
   off_t ofs; 
 
   ASSERT (dir != NULL);  // Ensure the directory is not NULL
   ASSERT (name != NULL);  // Ensure the name is not NULL
 
+  inode_dir_lock(dir->inode);
+
   // Lookup the directory entry by name and get its offset
-  if (!lookup(dir, name, &e, &ofs)){
-    return false;
-  }
+  if (!lookup(dir, name, &e, &ofs))
+    goto done;
 
   // Open the inode corresponding to the directory entry
   inode = inode_open(e.inode_sector);
   if (inode == NULL)
-    return false;
+    goto done;
 
-  // Ensure the directory is empty before removal
+  // Ensure the directory is empty before removal, holding its lock
+  // so that nothing is added to it in the meantime
   if (inode_is_dir(inode)) {
-    struct dir *sub_dir = dir_open(inode);  // Open the directory to check its contents
-    if (!dir_is_empty(sub_dir)) {
-      dir_close(sub_dir);
-      inode_close(inode);
-      return false;  // Return false if the directory is not empty
-    }
+    struct dir *sub_dir;
+
+    inode_dir_lock(inode);
+    child_locked = true;
+    sub_dir = dir_open(inode_reopen(inode));
+    if (sub_dir == NULL)
+      goto done;
+    empty = dir_is_empty(sub_dir);
     dir_close(sub_dir);
+    if (!empty)
+      goto done;
   }
 
   // Mark the directory entry as not in use
   e.in_use = false;
-  if (inode_write_at(dir->inode, &e, sizeof e, ofs) != sizeof e) {
-    inode_close(inode);
-    return false;
+  if (inode_write_at(dir->inode, &e, sizeof e, ofs) != sizeof e)
+    goto done;
+
+  // Forget the name, and any names inside it if it is a directory
+  name_cache_insert(inode_get_inumber(dir->inode), name, NAME_CACHE_ABSENT);
+  if (inode_is_dir(inode)) {
+    name_cache_purge_dir(e.inode_sector);
   }
 
   // Mark the inode as removed
   inode_remove(inode);
   success = true;
 
-  // Close the inode
+done:
+  if (child_locked)
+    inode_dir_unlock(inode);
   inode_close(inode);
-
-  if (success) {
-    buffer_cache_close(); // Ensure buffer cache is flushed to disk //change
-  }
-
+  inode_dir_unlock(dir->inode);
   return success;
 }
 
@@ -346,13 +695,15 @@ bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
     struct dir_entry e;
+    bool found;
 
-  while (inode_read_at(dir->inode, &e, sizeof e, dir->pos) == sizeof e) {
+  inode_dir_lock(dir->inode);
+  found = dir_scan(dir, &dir->pos, match_listed, NULL, &e);
+  inode_dir_unlock(dir->inode);
+  if (found) {
     dir->pos += sizeof e;
-    if (e.in_use && strcmp(e.name, ".") != 0 && strcmp(e.name, "..") != 0) {
-      strlcpy(name, e.name, NAME_MAX + 1);
-      return true;
-    }
+    strlcpy(name, e.name, NAME_MAX + 1);
+    return true;
   }
   return false;
 }
\ No newline at end of file
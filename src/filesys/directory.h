@@ -13,8 +13,13 @@
 
 struct inode;
 
+/** Most blocks of a journal transaction dir_remove() dirties: the
+   sector holding the entry. */
+#define DIR_REMOVE_CREDITS 1
+
 /** Opening and closing directories. */
 bool dir_create (block_sector_t sector, size_t entry_cnt);
+bool dir_format_ok (void);
 struct dir *dir_open (struct inode *);
 struct dir *dir_open_root (void);
 struct dir *dir_reopen (struct dir *);
@@ -24,6 +29,7 @@ struct inode *dir_get_inode (struct dir *);
 /** Reading and writing. */
 bool dir_lookup (const struct dir *, const char *name, struct inode **);
 bool dir_add (struct dir *dir, const char *name, block_sector_t inode_sector, int is_dir);
+size_t dir_add_credits (struct dir *);
 bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
 
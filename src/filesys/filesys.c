@@ -6,6 +6,8 @@
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
+#include "filesys/name-cache.h"
 #include "filesys/cache.h"
 #include "threads/thread.h"
 
@@ -27,17 +29,29 @@ filesys_init (bool format)
     PANIC ("No file system device found, can't initialize file system.");
 
   inode_init ();
+  name_cache_init ();
   free_map_init ();
   
   /* NEW: Initialize cache_list */
   buffer_cache_init();
+  journal_init ();
 
   // Initalize the root directory
   if (format) 
     do_format ();
 
+  /* Finish any metadata updates a crash interrupted, before anything
+     reads the file system. */
+  journal_open ();
+  if (!dir_format_ok ())
+    PANIC ("file system has directories in an older format, reformat it");
 
   free_map_open ();
+
+  /* Start writing dirty blocks back and reading ahead in the
+     background. */
+  buffer_cache_start_flusher ();
+  buffer_cache_start_read_ahead ();
 }
 
 /** Shuts down the file system module, writing any unwritten data
@@ -45,9 +59,35 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
-  /* Flush all dirty blocks to disk */
-  void buffer_cache_close();
+  inode_flush_delayed (0);
+  journal_close ();
   free_map_close ();
+  /* Flush all dirty blocks to disk */
+  buffer_cache_close ();
+}
+
+/** Fills in *STATS with the buffer cache counters and the file
+   system device's sector counts and I/O time. */
+void
+filesys_get_stats (struct fsstat *stats)
+{
+  struct block_stats dev;
+
+  buffer_cache_get_stats (stats);
+  block_get_stats (fs_device, &dev);
+  stats->sectors_read = dev.read_cnt;
+  stats->sectors_written = dev.write_cnt;
+  stats->read_cycles = dev.read_cycles;
+  stats->write_cycles = dev.write_cycles;
+  stats->free_sectors = free_map_free_cnt ();
+}
+
+/** Prints file system statistics at shutdown. */
+void
+filesys_print_stats (void)
+{
+  if (fs_device != NULL)
+    buffer_cache_print_stats ();
 }
 /** Creates a file named NAME with the given INITIAL_SIZE.
    Returns true if successful, false otherwise.
@@ -68,8 +108,14 @@ filesys_create (const char *name, off_t initial_size, int is_dir)
   }
 
   struct dir *dir = dir_open_path(dir_name);
+  // The new inode, and its entry in DIR
+  journal_begin(dir != NULL ? 1 + dir_add_credits(dir) : 0);
+  // Put a file's inode in its directory's group, and a new directory
+  // in a group of its own
   bool success = (dir != NULL
-                  && free_map_allocate(1, &inode_sector)
+                  && free_map_allocate_near(is_dir ? free_map_dir_hint()
+                                            : inode_get_inumber(dir_get_inode(dir)),
+                                            &inode_sector, false)
                   && inode_create(inode_sector, initial_size, is_dir)
                   && dir_add(dir, base_name, inode_sector, is_dir));
   
@@ -77,6 +123,7 @@ filesys_create (const char *name, off_t initial_size, int is_dir)
 
   if (!success && inode_sector != 0) 
     free_map_release(inode_sector, 1);
+  journal_end();
   dir_close(dir);
   free(dir_name);
   free(base_name);
@@ -135,16 +182,15 @@ filesys_remove (const char *name)
   bool success = false;
 
   if (dir != NULL) {
+    journal_begin(DIR_REMOVE_CREDITS);
     success = dir_remove(dir, base_name);
+    journal_end();
     dir_close(dir);
   }
 
   free(dir_name);
   free(base_name);
-  if (success) {
-    buffer_cache_close(); // Ensure buffer cache is flushed to disk //change
-  }
-  
+
   return success;
 }
 
@@ -154,6 +200,7 @@ do_format (void)
 {
   printf ("Formatting file system...");
   free_map_create ();
+  journal_create ();
   if (!dir_create (ROOT_DIR_SECTOR, 16))
     PANIC ("root directory creation failed");
   free_map_close ();
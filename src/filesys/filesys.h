@@ -2,12 +2,14 @@
 #define FILESYS_FILESYS_H
 
 #include <stdbool.h>
+#include <fsstat.h>
 #include "filesys/off_t.h"
 #include "filesys/directory.h" // Just for NAME_MAX
 
 /** Sectors of system file inodes. */
 #define FREE_MAP_SECTOR 0       /**< Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /**< Root directory file inode sector. */
+#define JOURNAL_SECTOR 2        /**< Journal header sector. */
 
 /** Block device that contains the file system. */
 struct block *fs_device;
@@ -15,6 +17,8 @@ struct block *fs_device;
 
 void filesys_init (bool format);
 void filesys_done (void);
+void filesys_get_stats (struct fsstat *);
+void filesys_print_stats (void);
 bool filesys_create (const char *name, off_t initial_size, int is_dir); 
 struct file *filesys_open (const char *name);
 bool filesys_remove (const char *name);
@@ -1,76 +1,330 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/** Bits of the free map stored in each sector of the free map file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+/** Sectors per allocation group. */
+#define GROUP_SECTORS 1024
 
 static struct file *free_map_file;   /**< Free map file. */
 static struct bitmap *free_map;      /**< Free map, one bit per sector. */
 
+/** The free map is kept in memory and written back lazily by
+   free_map_flush().  DIRTY has one bit per sector of the free map
+   file, set when some bit in that sector changed since it was last
+   written.  RELEASED marks sectors freed since the last flush: they
+   stay allocated in FREE_MAP until then, so that nothing reuses a
+   sector before the flush that follows the inode change that freed
+   it, nor one with a copy in the journal's log before the journal's
+   next checkpoint. */
+static struct bitmap *dirty;
+static struct bitmap *released;
+static size_t released_cnt;
+
+/** The disk is divided into groups of GROUP_SECTORS sectors, the last
+   one possibly shorter.  Allocation keeps related sectors in the same
+   group: a file's inode near its directory's, and its index and data
+   blocks near its inode, while new directories are spread across the
+   groups so that each has room to grow nearby.  GROUP_FREE counts the
+   free sectors of each group, so that full groups are skipped
+   without looking at their bits. */
+static size_t group_cnt;
+static size_t *group_free;
+static size_t dir_rotor;        /**< Group to try first for a directory. */
+
+/** FREE_CNT counts the free sectors of the whole disk.  RESERVED_CNT
+   of them are set aside by free_map_reserve() for data that is
+   written but not yet given sectors, and only allocations that spend
+   a reservation may take them, so that the data always finds room. */
+static size_t free_cnt;
+static size_t reserved_cnt;
+
+/** Protects all of the above. */
+static struct lock free_map_lock;
+
+static void mark_dirty (size_t sector, size_t cnt);
+static void apply_releases (void);
+static size_t find_run (size_t hint, size_t cnt);
+static size_t available (size_t cnt, bool reserved);
+static void take (size_t sector, size_t cnt, bool reserved);
+static void count_groups (void);
+static void adjust_groups (size_t sector, size_t cnt, bool allocated);
+
 /** Initializes the free map. */
 void
-free_map_init (void) 
+free_map_init (void)
 {
   free_map = bitmap_create (block_size (fs_device));
-  if (free_map == NULL)
+  released = bitmap_create (block_size (fs_device));
+  if (free_map == NULL || released == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  dirty = bitmap_create (DIV_ROUND_UP (bitmap_size (free_map), BITS_PER_SECTOR));
+  if (dirty == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  released_cnt = 0;
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), GROUP_SECTORS);
+  group_free = malloc (group_cnt * sizeof *group_free);
+  if (group_free == NULL)
+    PANIC ("can't allocate free map groups");
+  dir_rotor = 0;
+  reserved_cnt = 0;
+  lock_init (&free_map_lock);
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_mark (free_map, JOURNAL_SECTOR);
+  count_groups ();
 }
 
 /** Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  block_sector_t sector;
+
+  lock_acquire (&free_map_lock);
+  sector = BITMAP_ERROR;
+  if (available (cnt, false) == cnt)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      sector = find_run (0, cnt);
+      if (sector == BITMAP_ERROR && released_cnt > 0)
+        {
+          /* Running out of space: make the pending releases available
+             now rather than fail. */
+          apply_releases ();
+          sector = find_run (0, cnt);
+        }
     }
   if (sector != BITMAP_ERROR)
-    *sectorp = sector;
+    {
+      take (sector, cnt, false);
+      *sectorp = sector;
+    }
+  lock_release (&free_map_lock);
   return sector != BITMAP_ERROR;
 }
 
-/** Makes CNT sectors starting at SECTOR available for use. */
+/** Allocates one sector, as close after HINT as possible: in HINT's
+   group if it has room, otherwise in the next group that does, and
+   stores it into *SECTORP.  If RESERVED, the sector comes out of an
+   earlier free_map_reserve().  Returns true if successful, false if
+   the disk is full. */
+bool
+free_map_allocate_near (block_sector_t hint, block_sector_t *sectorp,
+                        bool reserved)
+{
+  block_sector_t sector = BITMAP_ERROR;
+
+  lock_acquire (&free_map_lock);
+  if (hint >= bitmap_size (free_map))
+    hint = 0;
+  if (available (1, reserved) == 1)
+    {
+      sector = find_run (hint, 1);
+      if (sector == BITMAP_ERROR && released_cnt > 0)
+        {
+          apply_releases ();
+          sector = find_run (hint, 1);
+        }
+    }
+  if (sector != BITMAP_ERROR)
+    {
+      take (sector, 1, reserved);
+      *sectorp = sector;
+    }
+  lock_release (&free_map_lock);
+  return sector != BITMAP_ERROR;
+}
+
+/** Returns the first sector of the group where a new directory
+   should go: the next group, in turn, with at least the average
+   number of free sectors, so that directories spread out across the
+   disk while staying away from groups that are filling up. */
+block_sector_t
+free_map_dir_hint (void)
+{
+  size_t total = 0;
+  size_t g, i;
+
+  lock_acquire (&free_map_lock);
+  for (g = 0; g < group_cnt; g++)
+    total += group_free[g];
+  for (i = 0; i < group_cnt; i++)
+    {
+      g = (dir_rotor + i) % group_cnt;
+      if (group_free[g] > 0 && group_free[g] * group_cnt >= total)
+        break;
+    }
+  if (i == group_cnt)
+    g = dir_rotor % group_cnt;
+  dir_rotor = g + 1;
+  lock_release (&free_map_lock);
+  return g * GROUP_SECTORS;
+}
+
+/** Allocates a run of up to CNT consecutive sectors, preferably
+   starting at HINT, and stores the first into *SECTORP.  If HINT
+   is free, the run starts there and is as long as the free space
+   after it allows.  Otherwise it is the first run of CNT sectors
+   at or after HINT (wrapping around to the start of the disk),
+   or of half as many if there is none, and so on down to a
+   single sector.  If RESERVED, the sectors come out of an earlier
+   free_map_reserve().  Returns the number of sectors allocated, 0
+   if the disk is full. */
+size_t
+free_map_allocate_extent (size_t cnt, block_sector_t hint,
+                          block_sector_t *sectorp, bool reserved)
+{
+  size_t size = bitmap_size (free_map);
+  size_t start = BITMAP_ERROR;
+  size_t got = 0;
+
+  lock_acquire (&free_map_lock);
+  cnt = available (cnt, reserved);
+  if (hint >= size)
+    hint = 0;
+  if (cnt > 0 && !bitmap_test (free_map, hint))
+    {
+      /* Continue right where the caller left off. */
+      start = hint;
+      for (got = 1; got < cnt && start + got < size; got++)
+        if (bitmap_test (free_map, start + got))
+          break;
+    }
+  else
+    for (got = cnt; got > 0; got /= 2)
+      {
+        start = find_run (hint, got);
+        if (start == BITMAP_ERROR && got == 1 && released_cnt > 0)
+          {
+            apply_releases ();
+            start = find_run (hint, got);
+          }
+        if (start != BITMAP_ERROR)
+          break;
+      }
+  if (got > 0)
+    {
+      take (start, got, reserved);
+      *sectorp = start;
+    }
+  lock_release (&free_map_lock);
+  return got;
+}
+
+/** Returns the number of free sectors on the disk, counting those
+   set aside by free_map_reserve() but not those released since the
+   last free_map_flush(). */
+size_t
+free_map_free_cnt (void)
+{
+  size_t cnt;
+
+  lock_acquire (&free_map_lock);
+  cnt = free_cnt;
+  lock_release (&free_map_lock);
+  return cnt;
+}
+
+/** Sets aside CNT free sectors for later allocations that pass
+   RESERVED as true, so that other allocations can't take them.
+   Returns false if there aren't that many to spare. */
+bool
+free_map_reserve (size_t cnt)
+{
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = available (cnt, false) == cnt;
+  if (success)
+    reserved_cnt += cnt;
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/** Gives back CNT sectors set aside by free_map_reserve() but not
+   allocated after all. */
+void
+free_map_unreserve (size_t cnt)
+{
+  lock_acquire (&free_map_lock);
+  ASSERT (reserved_cnt >= cnt);
+  reserved_cnt -= cnt;
+  lock_release (&free_map_lock);
+}
+
+/** Makes CNT sectors starting at SECTOR available for use, as of
+   the next free_map_flush(). */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  ASSERT (bitmap_none (released, sector, cnt));
+  bitmap_set_multiple (released, sector, cnt, true);
+  released_cnt += cnt;
+  lock_release (&free_map_lock);
+}
+
+/** Makes the sectors released since the last flush available and
+   writes the sectors of the free map that changed back to the free
+   map file, in the buffer cache.  The journal calls it as part of
+   each commit, so that the free map on disk always matches the
+   inodes. */
+void
+free_map_flush (void)
+{
+  size_t idx;
+
+  lock_acquire (&free_map_lock);
+  apply_releases ();
+  if (free_map_file != NULL)
+    for (idx = bitmap_scan (dirty, 0, 1, true); idx != BITMAP_ERROR;
+         idx = bitmap_scan (dirty, idx + 1, 1, true))
+      {
+        if (!bitmap_write_part (free_map, free_map_file,
+                                idx * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE))
+          PANIC ("can't write free map");
+        bitmap_reset (dirty, idx);
+      }
+  lock_release (&free_map_lock);
 }
 
 /** Opens the free map file and reads it from disk. */
 void
-free_map_open (void) 
+free_map_open (void)
 {
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  count_groups ();
 }
 
 /** Writes the free map to disk and closes the free map file. */
 void
-free_map_close (void) 
+free_map_close (void)
 {
+  free_map_flush ();
   file_close (free_map_file);
 }
 
 /** Creates a new free map file on disk and writes the free map to
    it. */
 void
-free_map_create (void) 
+free_map_create (void)
 {
   /* Create inode. */
   if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), 0))
@@ -82,4 +336,162 @@ free_map_create (void)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+
+  /* The file starts out as a hole, so writing it allocated its own
+     blocks and marked those bits dirty.  Clear them, rewriting
+     whatever changed. */
+  free_map_flush ();
+}
+
+/** Records that the bits for CNT sectors starting at SECTOR
+   changed.  The caller must hold free_map_lock. */
+static void
+mark_dirty (size_t sector, size_t cnt)
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+
+  ASSERT (cnt > 0);
+  bitmap_set_multiple (dirty, first, last - first + 1, true);
+}
+
+/** Frees the sectors released since the last flush, except those
+   the journal logged since its last checkpoint or holds in the
+   running transaction, which wait for a later flush.  The caller
+   must hold free_map_lock. */
+static void
+apply_releases (void)
+{
+  size_t left = released_cnt;
+  size_t idx;
+
+  if (released_cnt == 0)
+    return;
+  for (idx = bitmap_scan (released, 0, 1, true); idx != BITMAP_ERROR;
+       idx = bitmap_scan (released, idx + 1, 1, true))
+    {
+      if (!journal_logged (idx))
+        {
+          bitmap_reset (released, idx);
+          bitmap_reset (free_map, idx);
+          adjust_groups (idx, 1, false);
+          mark_dirty (idx, 1);
+          released_cnt--;
+        }
+      if (--left == 0)
+        break;
+    }
+}
+
+/** Returns the first sector of a run of CNT free sectors at or after
+   HINT, wrapping around to the start of the disk, or BITMAP_ERROR if
+   there is none.  Groups with no free sectors are stepped over
+   without scanning.  The caller must hold free_map_lock. */
+static size_t
+find_run (size_t hint, size_t cnt)
+{
+  size_t size = bitmap_size (free_map);
+  size_t pos = hint;
+  bool wrapped = false;
+
+  for (;;)
+    {
+      size_t g = pos / GROUP_SECTORS;
+
+      if (group_free[g] == 0)
+        pos = (g + 1) * GROUP_SECTORS;
+      else
+        {
+          size_t start = bitmap_scan (free_map, pos, cnt, false);
+          if (start != BITMAP_ERROR)
+            return start;
+          pos = size;
+        }
+      if (pos >= size)
+        {
+          if (wrapped || hint == 0)
+            return BITMAP_ERROR;
+          wrapped = true;
+          pos = 0;
+        }
+      else if (wrapped && pos >= hint)
+        return BITMAP_ERROR;
+    }
+}
+
+/** Returns how many of CNT sectors an allocation may have: all of
+   them if it spends a RESERVED sector, otherwise no more than are
+   free beyond the reservations, counting the pending releases if
+   need be.  The caller must hold free_map_lock. */
+static size_t
+available (size_t cnt, bool reserved)
+{
+  size_t avail;
+
+  if (reserved)
+    return cnt;
+  if (free_cnt < reserved_cnt + cnt && released_cnt > 0)
+    apply_releases ();
+  avail = free_cnt > reserved_cnt ? free_cnt - reserved_cnt : 0;
+  return cnt < avail ? cnt : avail;
+}
+
+/** Marks the CNT free sectors starting at SECTOR allocated, out of
+   the reservations if RESERVED.  The caller must hold
+   free_map_lock. */
+static void
+take (size_t sector, size_t cnt, bool reserved)
+{
+  ASSERT (bitmap_none (free_map, sector, cnt));
+  bitmap_set_multiple (free_map, sector, cnt, true);
+  adjust_groups (sector, cnt, true);
+  mark_dirty (sector, cnt);
+  if (reserved)
+    reserved_cnt -= cnt < reserved_cnt ? cnt : reserved_cnt;
+}
+
+/** Counts the free sectors of each group, and of the disk, afresh. */
+static void
+count_groups (void)
+{
+  size_t g;
+
+  free_cnt = 0;
+  for (g = 0; g < group_cnt; g++)
+    {
+      size_t first = g * GROUP_SECTORS;
+      size_t cnt = bitmap_size (free_map) - first;
+      if (cnt > GROUP_SECTORS)
+        cnt = GROUP_SECTORS;
+      group_free[g] = bitmap_count (free_map, first, cnt, false);
+      free_cnt += group_free[g];
+    }
+}
+
+/** Updates the free counts of the groups holding the CNT sectors
+   starting at SECTOR, which were just ALLOCATED or freed.  The caller
+   must hold free_map_lock. */
+static void
+adjust_groups (size_t sector, size_t cnt, bool allocated)
+{
+  while (cnt > 0)
+    {
+      size_t g = sector / GROUP_SECTORS;
+      size_t n = (g + 1) * GROUP_SECTORS - sector;
+      if (n > cnt)
+        n = cnt;
+      if (allocated)
+        {
+          ASSERT (group_free[g] >= n);
+          group_free[g] -= n;
+          free_cnt -= n;
+        }
+      else
+        {
+          group_free[g] += n;
+          free_cnt += n;
+        }
+      sector += n;
+      cnt -= n;
+    }
 }
@@ -12,6 +12,15 @@ void free_map_open (void);
 void free_map_close (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
+bool free_map_allocate_near (block_sector_t hint, block_sector_t *,
+                             bool reserved);
+block_sector_t free_map_dir_hint (void);
+size_t free_map_free_cnt (void);
+size_t free_map_allocate_extent (size_t, block_sector_t hint, block_sector_t *,
+                                 bool reserved);
+bool free_map_reserve (size_t);
+void free_map_unreserve (size_t);
 void free_map_release (block_sector_t, size_t);
+void free_map_flush (void);
 
 #endif /**< filesys/free-map.h */
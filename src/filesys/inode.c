@@ -1,13 +1,17 @@
 #include "filesys/inode.h"
 #include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 #include "filesys/cache.h"
+#include "devices/timer.h"
 #include "threads/interrupt.h"
+#include "threads/synch.h"
 
 //#define debug_printf(fmt, ...) printf(fmt, ##__VA_ARGS__)
 #define debug_printf(fmt, ...) // Define as empty if debugging is disabled
@@ -15,21 +19,64 @@
 /** Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
-#define DIRECT_COUNT 123
+#define DIRECT_COUNT 122
 #define INDIRECT_COUNT 128
+/** Data blocks mapped through one double indirect block. */
+#define DBL_INDIRECT_SPAN (INDIRECT_COUNT * INDIRECT_COUNT)
+/** First data block mapped through the double indirect block. */
+#define DBL_INDIRECT_FIRST (DIRECT_COUNT + INDIRECT_COUNT)
+/** First data block mapped through the triple indirect block. */
+#define TPL_INDIRECT_FIRST (DBL_INDIRECT_FIRST + DBL_INDIRECT_SPAN)
+/** Most data blocks a file can have, about 1 GB worth. */
+#define MAX_BLOCKS (TPL_INDIRECT_FIRST + INDIRECT_COUNT * DBL_INDIRECT_SPAN)
+
+#define READ_AHEAD_MIN 2    /**< Read-ahead window once a sequential read is seen. */
+#define READ_AHEAD_MAX 32   /**< Largest read-ahead window, in sectors. */
+#define IO_BATCH 16         /**< Sectors translated per ranged cache transfer. */
+#define EXTENT_MAX 1024     /**< Most data sectors reserved from the free map at once. */
+#define CLOSED_INODES_MAX 32 /**< Closed inodes kept in memory for reopening. */
+#define DELAY_MAX 64        /**< Most delayed blocks per inode. */
+#define DELAY_INDEX_MAX 8   /**< Most index blocks on the way to an inode's delayed blocks. */
+#define WRITE_CHUNK 32      /**< Most blocks a write or fallocate covers per transaction. */
+#define DELAY_FLUSH_BATCH 16 /**< Inodes inode_flush_delayed() takes at once. */
+/** Most bytes of data kept inline, in place of the block map. */
+#define INLINE_MAX ((DIRECT_COUNT + 3) * sizeof (block_sector_t))
+/** Flag in the block map entry of a data block preallocated by
+   inode_fallocate() and not yet written. */
+#define UNWRITTEN ((block_sector_t) 1 << 31)
 
 /** On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+   A block map entry of 0, whether a data block or an index block, is
+   a hole: nothing has been written there, so it reads as zeros and
+   takes no space.  Sector 0 holds the free map's inode, so it is
+   never anyone's data.  A data block entry with UNWRITTEN set has
+   its sector, but reads as zeros without reading it until it is
+   first written.
+   A file or directory created no longer than INLINE_MAX bytes keeps
+   its data inline, in the inode sector itself, until it grows past
+   that; then the data moves out to a block and the block map takes
+   its place. */
 struct inode_disk
 {
   off_t length;                       /**< File size in bytes. */
   unsigned magic;                     /**< Magic number. */
   bool directory;                     // New: if true is directory
+  bool inline_data;                   /**< Data in INLINE_BYTES? */
+  uint8_t unused[2];
 
-  // New: using indexing direct/indirect blocks
-  block_sector_t direct_blocks[DIRECT_COUNT];
-  block_sector_t indirect_block;
-  block_sector_t double_indirect_block;
+  union
+    {
+      // New: using indexing direct/indirect blocks
+      struct
+        {
+          block_sector_t direct_blocks[DIRECT_COUNT];
+          block_sector_t indirect_block;
+          block_sector_t double_indirect_block;
+          block_sector_t triple_indirect_block;
+        };
+      uint8_t inline_bytes[INLINE_MAX];
+    };
 };
 
 /** Returns the number of sectors to allocate for an inode SIZE
@@ -40,232 +87,750 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
+/** A data block of a file that was written but has no sector yet.
+   Its data is in the buffer cache under a temporary sector number. */
+struct delayed_block
+  {
+    off_t index;                        /**< Data block number in the file. */
+    block_sector_t temp;                /**< Temporary sector, 0 once assigned. */
+  };
+
 /** In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /**< Element in inode list. */
+    /* Protected by inode_table_lock. */
+    struct hash_elem hash_elem;         /**< Element in inode table. */
+    struct list_elem elem;              /**< Element in closed_inodes. */
     block_sector_t sector;              /**< Sector number of disk location. */
     int open_cnt;                       /**< Number of openers. */
     bool removed;                       /**< True if deleted, false otherwise. */
+    bool loading;                       /**< Being read from disk by inode_open()? */
+
+    /* Protected by RW: held for reading to read the data, for
+       writing to write it or change the length or block map. */
+    struct rwlock rw;                   /**< Data lock. */
     int deny_write_cnt;                 /**< 0: writes ok, >0: deny writes. */
     struct inode_disk data;             /**< Inode content. */
 
-  
+    /* Delayed allocation: blocks written into the holes of a regular
+       file get sectors only when they are about to be written back, so
+       that a run of small appends is laid out as one extent and a file
+       deleted first never takes any.  They are listed here in block
+       order, and DELAY_RESERVED sectors are set aside in the free map
+       for them and the index blocks they may need.  Placing them
+       dirties the DELAY_INDEX_CNT index blocks on the way to them,
+       kept within DELAY_INDEX_MAX so that one journal transaction
+       has room for them. */
+    struct delayed_block delayed[DELAY_MAX];
+    size_t delayed_cnt;                 /**< Number of delayed blocks. */
+    size_t delay_reserved;              /**< Sectors reserved for them. */
+    size_t delay_index_cnt;             /**< Index blocks on the way to them. */
+    int64_t delayed_since;              /**< Tick when the oldest was written. */
+    bool delay_pinned;                  /**< Kept open by inode_close() till they are placed. */
+    uint32_t meta_txn;                  /**< Journal transaction that last changed
+                                             the inode, and so maybe its length or
+                                             block map. */
+
+    struct lock dir_lock;               /**< See inode_dir_lock(). */
+
+    /* Read-ahead state, a heuristic so updated without locking. */
+    off_t ra_next;                      /**< Block a sequential read would start at. */
+    off_t ra_limit;                     /**< Blocks before this are already queued. */
+    off_t ra_window;                    /**< Blocks to prefetch, 0 if access is random. */
+
+    /* Translation cache: a copy of the index block that maps the data
+       blocks XL_FIRST...XL_FIRST + INDIRECT_COUNT - 1, the one used
+       last, so that walking through a file reads each index block
+       from the buffer cache only once.  Past TPL_INDIRECT_FIRST it
+       also remembers the double indirect block used last, so that
+       even there finding the next index block takes one lookup. */
+    struct lock xl_lock;                /**< Protects the members below. */
+    off_t xl_first;                     /**< First block XL_MAP maps, -1 if empty. */
+    block_sector_t xl_map[INDIRECT_COUNT]; /**< Copy of that index block. */
+    off_t xl_dbl_slot;                  /**< Triple indirect slot of XL_DBL, -1 if none. */
+    block_sector_t xl_dbl;              /**< Double indirect block in that slot. */
   };
 
-/* New: From the index, retrieve the sector */
-static block_sector_t get_index_sector(const struct inode_disk *disk, off_t index) {
-    // printf("(get_index_sector) start\n");
+/* New: Returns slot SLOT of the index block at INDEX_SECTOR, reading it
+   in place in the buffer cache. */
+static block_sector_t index_block_lookup(block_sector_t index_sector, size_t slot) {
+    struct buffer_block *block = buffer_cache_get(index_sector);
+    block_sector_t sector = ((block_sector_t *) block->buf)[slot];
+    buffer_cache_put(block, false);
+    return sector;
+}
 
-    // index is in direct block
-    if (index < DIRECT_COUNT) {
-        // printf("(get_index_sector) index is in direct block\n");
-        return disk->direct_blocks[index];
+/* New: Returns the slot of data block INDEX, which must be past the
+   direct blocks, in the index block that maps it. */
+static size_t index_slot(off_t index) {
+    if (index < DBL_INDIRECT_FIRST) {
+        return index - DIRECT_COUNT;
+    }
+    if (index < TPL_INDIRECT_FIRST) {
+        return (index - DBL_INDIRECT_FIRST) % INDIRECT_COUNT;
     }
+    return (index - TPL_INDIRECT_FIRST) % INDIRECT_COUNT;
+}
+
+/* New: Names the index block at LEVEL on the way to data block INDEX:
+   1 for the one that maps it, 2 for the double indirect block above
+   that, 3 for the triple indirect block.  Returns the first data block
+   that index block maps, which tells it apart from the others at its
+   level, or -1 if INDEX needs none at LEVEL. */
+static off_t index_block_id(off_t index, int level) {
+    if (index < DIRECT_COUNT || (index < DBL_INDIRECT_FIRST && level > 1)
+        || (index < TPL_INDIRECT_FIRST && level > 2)) {
+        return -1;
+    }
+    if (level == 1) {
+        return index - index_slot(index);
+    }
+    if (level == 2 && index >= TPL_INDIRECT_FIRST) {
+        return index - (index - TPL_INDIRECT_FIRST) % DBL_INDIRECT_SPAN;
+    }
+    return level == 2 ? DBL_INDIRECT_FIRST : TPL_INDIRECT_FIRST;
+}
 
-    // index is in indirect block
-    index -= DIRECT_COUNT;
-    if (index < INDIRECT_COUNT) {
-      // printf("(get_index_sector) index is in indirect block\n");
-      block_sector_t indirect_blocks[INDIRECT_COUNT];
-      buffer_cache_read(disk->indirect_block, indirect_blocks, 0, BLOCK_SECTOR_SIZE);
-      return indirect_blocks[index];
+/* New: Returns the number of index blocks on the way to data blocks
+   FIRST...FIRST + CNT - 1, each counted once. */
+static size_t index_blocks_spanned(off_t first, size_t cnt) {
+    size_t n = 0;
+    for (int level = 1; level <= 3; level++) {
+        off_t prev = -1;
+        for (size_t i = 0; i < cnt; i++) {
+            off_t id = index_block_id(first + i, level);
+            if (id != -1 && id != prev) {
+                n++;
+            }
+            prev = id;
+        }
     }
+    return n;
+}
 
-    // index is in doubly indirect block
-    index -= INDIRECT_COUNT;
-    if (index < (INDIRECT_COUNT * INDIRECT_COUNT)) {
-      // printf("(get_index_sector) index is in doubly indirect block\n");
-      block_sector_t doubly_indirect_blocks[INDIRECT_COUNT];
-      buffer_cache_read(disk->double_indirect_block, doubly_indirect_blocks, 0, BLOCK_SECTOR_SIZE);
-      block_sector_t indirect_block;
-      size_t indirect_index = index / INDIRECT_COUNT;
-      size_t direct_index = index % INDIRECT_COUNT;
-      buffer_cache_read(doubly_indirect_blocks[indirect_index], &indirect_block, 0, BLOCK_SECTOR_SIZE);
-      buffer_cache_read(indirect_block, doubly_indirect_blocks, 0, BLOCK_SECTOR_SIZE);
-      return doubly_indirect_blocks[direct_index];
+/* New: Returns the sector of the index block that maps data block
+   INDEX, which must be past the direct blocks, or 0 if it doesn't
+   exist yet.  Under the triple indirect block, the double indirect
+   block on the way comes from the translation cache if it can.  The
+   caller must hold INODE's xl_lock. */
+static block_sector_t index_block_sector(struct inode *inode, off_t index) {
+    if (index < DBL_INDIRECT_FIRST) {
+        return inode->data.indirect_block;
+    }
+    block_sector_t dbl = inode->data.double_indirect_block;
+    off_t rel = index - DBL_INDIRECT_FIRST;
+    if (index >= TPL_INDIRECT_FIRST) {
+        off_t slot = (index - TPL_INDIRECT_FIRST) / DBL_INDIRECT_SPAN;
+        if (inode->xl_dbl_slot != slot) {
+            inode->xl_dbl = inode->data.triple_indirect_block != 0
+                            ? index_block_lookup(inode->data.triple_indirect_block, slot) : 0;
+            inode->xl_dbl_slot = slot;
+        }
+        dbl = inode->xl_dbl;
+        rel = (index - TPL_INDIRECT_FIRST) % DBL_INDIRECT_SPAN;
     }
+    return dbl != 0 ? index_block_lookup(dbl, rel / INDIRECT_COUNT) : 0;
+}
+
+/* New: Makes INODE's translation cache hold the index block that maps
+   data block INDEX, which must be past the direct blocks, and returns
+   the slot for INDEX in it.  The caller must hold INODE's xl_lock. */
+static size_t translation_load(struct inode *inode, off_t index) {
+    off_t first = index - index_slot(index);
+    if (inode->xl_first != first) {
+        block_sector_t index_sector = index_block_sector(inode, index);
+        // A missing index block maps nothing but holes
+        if (index_sector == 0) {
+            memset(inode->xl_map, 0, sizeof inode->xl_map);
+        } else {
+            buffer_cache_read(index_sector, inode->xl_map, 0, BLOCK_SECTOR_SIZE);
+        }
+        inode->xl_first = first;
+    }
+    return index - first;
+}
+
+/* New: Empties INODE's translation cache.  Must be called whenever
+   INODE's index blocks change. */
+static void translation_reset(struct inode *inode) {
+    lock_acquire(&inode->xl_lock);
+    inode->xl_first = -1;
+    inode->xl_dbl_slot = -1;
+    lock_release(&inode->xl_lock);
+}
+
+/* New: Returns the position in INODE's delayed blocks of the one for
+   data block INDEX, or of where it would go. */
+static size_t delayed_find(const struct inode *inode, off_t index) {
+    size_t lo = 0, hi = inode->delayed_cnt;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (inode->delayed[mid].index < index) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* New: Translates the CNT consecutive blocks starting at block FIRST
+   of INODE into SECTORS, going through the translation cache for
+   blocks past the direct ones.  Holes translate to 0, and delayed
+   blocks to their temporary sectors. */
+static void get_index_sectors(struct inode *inode, off_t first,
+                              size_t cnt, block_sector_t *sectors) {
+    block_sector_t *out = sectors;
+    off_t out_first = first;
+    size_t out_cnt = cnt;
+
+    // Readers share the cache, so it needs a lock of its own
+    lock_acquire(&inode->xl_lock);
+    while (cnt > 0) {
+        size_t run;
+
+        if (first < DIRECT_COUNT) {
+            run = (size_t) (DIRECT_COUNT - first) < cnt ? (size_t) (DIRECT_COUNT - first) : cnt;
+            memcpy(sectors, &inode->data.direct_blocks[first], run * sizeof *sectors);
+        } else {
+            // Every block up to the end of the index block shares it
+            size_t slot = translation_load(inode, first);
+            run = INDIRECT_COUNT - slot < cnt ? INDIRECT_COUNT - slot : cnt;
+            memcpy(sectors, &inode->xl_map[slot], run * sizeof *sectors);
+        }
+        sectors += run;
+        first += run;
+        cnt -= run;
+    }
+    lock_release(&inode->xl_lock);
+
+    // The map has holes where the delayed blocks are
+    for (size_t i = 0; i < out_cnt && inode->delayed_cnt > 0; i++) {
+        if (out[i] == 0) {
+            size_t pos = delayed_find(inode, out_first + i);
+            if (pos < inode->delayed_cnt && inode->delayed[pos].index == out_first + (off_t) i) {
+                out[i] = inode->delayed[pos].temp;
+            }
+        }
+    }
+}
+
+/* New: From the index, retrieve the sector */
+static block_sector_t get_index_sector(struct inode *inode, off_t index) {
+    block_sector_t sector;
 
     // Handle index out of bounds
-    return -1;
+    if (index >= MAX_BLOCKS) {
+        return -1;
+    }
+    get_index_sectors(inode, index, 1, &sector);
+    return sector;
+}
+
+/* New: Points data block INDEX of INODE, whose index blocks must
+   exist, at SECTOR.  Index blocks are changed in place in the buffer
+   cache; the caller writes back the inode itself and resets the
+   translation cache. */
+static void set_index_sector(struct inode *inode, off_t index, block_sector_t sector) {
+    if (index < DIRECT_COUNT) {
+        inode->data.direct_blocks[index] = sector;
+        return;
+    }
+    lock_acquire(&inode->xl_lock);
+    block_sector_t index_sector = index_block_sector(inode, index);
+    lock_release(&inode->xl_lock);
+    struct buffer_block *block = buffer_cache_get(index_sector);
+    ((block_sector_t *) block->buf)[index_slot(index)] = sector;
+    buffer_cache_put_owned(block, inode->sector, true);
+}
+
+/* New: Writes INODE's on-disk inode to the buffer cache, noting the
+   journal transaction it goes in for inode_sync(). */
+static void write_disk_inode(struct inode *inode) {
+    inode->meta_txn = journal_running();
+    buffer_cache_write(inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE, inode->sector, true);
 }
 
 /** Returns the block device sector that contains byte offset POS
    within INODE.
    Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   POS, or 0 if POS lies in a hole. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos) 
 {
   ASSERT (inode != NULL);
-  if (pos < inode->data.length) {
-    return get_index_sector(&inode->data, (pos / BLOCK_SECTOR_SIZE));
+  if (pos < inode->data.length && !inode->data.inline_data) {
+    return get_index_sector(inode, (pos / BLOCK_SECTOR_SIZE));
   }
   else {
     return -1;
   }
 }
 
-/** List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/** Table of in-memory inodes, keyed by sector, so that opening a
+   single inode twice returns the same `struct inode'.  Besides the
+   open inodes it holds the CLOSED_INODES_MAX most recently closed
+   ones, which are also on closed_inodes, most recent first, so that
+   reopening a hot file or directory needs neither a disk read nor
+   even a buffer cache lookup. */
+static struct hash inodes;
+static struct list closed_inodes;
+static size_t closed_inode_cnt;
+
+/** Protects the above and the open count and removed and loading
+   flags of every inode.  Never held while acquiring an inode's own
+   locks, nor across disk I/O. */
+static struct lock inode_table_lock;
+
+/** Signaled when an inode that was loading is ready. */
+static struct condition inode_loaded;
+
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, hash_elem)->sector);
+}
+
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, hash_elem)->sector
+          < hash_entry (b, struct inode, hash_elem)->sector);
+}
+
+/** Returns the in-memory inode for SECTOR, open or not, or a null
+   pointer if there is none.  The caller must hold inode_table_lock. */
+static struct inode *
+inode_lookup (block_sector_t sector)
+{
+  struct inode probe;
+  struct hash_elem *e;
+
+  probe.sector = sector;
+  e = hash_find (&inodes, &probe.hash_elem);
+  return e != NULL ? hash_entry (e, struct inode, hash_elem) : NULL;
+}
+
+/** Frees INODE, which must be closed, forgetting it.  The caller
+   must hold inode_table_lock. */
+static void
+inode_forget (struct inode *inode)
+{
+  ASSERT (inode->open_cnt == 0);
+  list_remove (&inode->elem);
+  closed_inode_cnt--;
+  hash_delete (&inodes, &inode->hash_elem);
+  free (inode);
+}
 
 /** Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&inodes, inode_hash, inode_less, NULL))
+    PANIC ("can't allocate inode table");
+  list_init (&closed_inodes);
+  closed_inode_cnt = 0;
+  lock_init (&inode_table_lock);
+  cond_init (&inode_loaded);
 }
 
 
-/** Allocates the blocks for the inode based on the length **/
-static bool inode_allocate(struct inode_disk *disk_inode, off_t length) {
-  // printf("(inode_allocate) start, length:%u\n", length);
-  
-  // string of zeros
-  static char zero[BLOCK_SECTOR_SIZE];
-
-  // get how many sectors the write will take
-  size_t sector_ct = bytes_to_sectors(length);
-  // printf("(inode_allocate) sector_ct:%u\n", sector_ct);
-  size_t direct_ct = sector_ct;
-  size_t indirect_ct = 0;
-  size_t dbl_indirect_ct = 0;
+/** A run of data sectors reserved in one go from the free map for a
+   file being extended, handed out in order so the file's data ends up
+   contiguous on disk. **/
+struct extent
+  {
+    block_sector_t next;        /**< Next sector to hand out. */
+    size_t left;                /**< Sectors left in the run. */
+    block_sector_t hint;        /**< Sector after the file's last data sector. */
+    size_t blocks;              /**< Data blocks the file is growing to. */
+    block_sector_t owner;       /**< Inode sector of the file. */
+    struct inode *delayed;      /**< File whose delayed blocks are being placed, or null. */
+    bool unwritten;             /**< Mark new data blocks unwritten instead of zeroing them. */
+  };
 
-  // Determine the count of direct, indirect, and doubly indirect blocks
-  if (sector_ct > DIRECT_COUNT) {
-    // gonna need indrect blocks
-    direct_ct = DIRECT_COUNT;
-    sector_ct -= DIRECT_COUNT;
-    indirect_ct = sector_ct;
+/** Takes CNT sectors allocated for EXT out of the reservation of the
+   file whose delayed blocks they are for, if any. **/
+static void spend_reserved(struct extent *ext, size_t cnt) {
+  if (ext->delayed != NULL) {
+    ext->delayed->delay_reserved -= cnt < ext->delayed->delay_reserved ? cnt
+                                    : ext->delayed->delay_reserved;
+  }
+}
 
-    if (sector_ct > INDIRECT_COUNT) {
-      // gonna need double indirect blocks
-      indirect_ct = INDIRECT_COUNT;
-      sector_ct -= INDIRECT_COUNT;
-      dbl_indirect_ct = sector_ct;
+/** Allocates a zero-filled sector into *SECTORP for the file EXT
+   extends unless it already holds one, as close after HINT as the free
+   map can manage. **/
+static bool allocate_sector(block_sector_t *sectorp, struct extent *ext, block_sector_t hint) {
+  if (*sectorp != 0) {
+    return true;
+  }
+  if (!free_map_allocate_near(hint, sectorp, ext->delayed != NULL)) {
+    return false;
+  }
+  spend_reserved(ext, 1);
+  // init the block's values to zero, without reading the old contents
+  buffer_cache_put_owned(buffer_cache_get_zero(*sectorp), ext->owner, true);
+  return true;
+}
 
-      if (sector_ct > 0) {
-        // not enough space
-        return false;
-      }
+/** Allocates a zero-filled sector for data block INDEX into *SECTORP
+   from EXT unless it already holds one.  When EXT runs dry it reserves
+   a run for all the blocks still to come, right after the last one if
+   possible. **/
+static bool allocate_data_sector(block_sector_t *sectorp, size_t index, struct extent *ext) {
+  if (*sectorp != 0) {
+    ext->hint = (*sectorp & ~UNWRITTEN) + 1;
+    return true;
+  }
+  if (ext->left == 0) {
+    size_t want = ext->blocks - index < EXTENT_MAX ? ext->blocks - index : EXTENT_MAX;
+    ext->left = free_map_allocate_extent(want, ext->hint, &ext->next, ext->delayed != NULL);
+    if (ext->left == 0) {
+      return false;
+    }
+    spend_reserved(ext, ext->left);
+  }
+  *sectorp = ext->next++;
+  ext->left--;
+  ext->hint = *sectorp + 1;
+  // a delayed block already has its data in the cache
+  if (ext->delayed != NULL) {
+    size_t pos = delayed_find(ext->delayed, index);
+    if (pos < ext->delayed->delayed_cnt && ext->delayed->delayed[pos].index == (off_t) index) {
+      buffer_cache_assign(ext->delayed->delayed[pos].temp, *sectorp);
+      ext->delayed->delayed[pos].temp = 0;
+      return true;
     }
   }
+  // a preallocated block needn't be zeroed until it is written
+  if (ext->unwritten) {
+    *sectorp |= UNWRITTEN;
+    return true;
+  }
+  // init the block's values to zero, without reading the old contents
+  buffer_cache_put_owned(buffer_cache_get_zero(*sectorp), ext->owner, false);
+  return true;
+}
+
+/** Makes sure the index block in *INDEX_SECTOR exists and that its
+   CNT slots from SLOT on, for data blocks FIRST onward, point at
+   allocated sectors.  The index block is updated in place in the
+   buffer cache. **/
+static bool allocate_index_block(block_sector_t *index_sector, size_t slot, size_t first,
+                                 size_t cnt, struct extent *ext) {
+  // keep the index block among the data blocks it maps
+  if (!allocate_sector(index_sector, ext, ext->hint)) {
+    return false;
+  }
+  struct buffer_block *block = buffer_cache_get(*index_sector);
+  block_sector_t *slots = (block_sector_t *) block->buf;
+  bool success = true;
+  for (size_t i = 0; i < cnt && success; i++) {
+    success = allocate_data_sector(&slots[slot + i], first + i, ext);
+  }
+  buffer_cache_put_owned(block, ext->owner, true);
+  return success;
+}
+
+/** Makes sure the double indirect block in *DBL_SECTOR, which maps the
+   data blocks from BASE on, exists and that data blocks LO...HI - 1,
+   all among those, are allocated along with their index blocks. **/
+static bool allocate_dbl_indirect_block(block_sector_t *dbl_sector, size_t base, size_t lo,
+                                        size_t hi, struct extent *ext) {
+  if (!allocate_sector(dbl_sector, ext, ext->hint)) {
+    return false;
+  }
+  struct buffer_block *block = buffer_cache_get(*dbl_sector);
+  block_sector_t *indirect_blocks = (block_sector_t *) block->buf;
+  bool success = true;
+  while (lo < hi && success) {
+    size_t slot = (lo - base) % INDIRECT_COUNT;
+    size_t cnt = hi - lo < INDIRECT_COUNT - slot ? hi - lo : INDIRECT_COUNT - slot;
+    success = allocate_index_block(&indirect_blocks[(lo - base) / INDIRECT_COUNT],
+                                   slot, lo, cnt, ext);
+    lo += cnt;
+  }
+  buffer_cache_put_owned(block, ext->owner, true);
+  return success;
+}
+
+/** Fills the holes among data blocks FIRST...END - 1 of the inode at
+   OWNER, along with any index blocks they need.  New data blocks are
+   taken from the free map in extents, starting at HINT if possible,
+   so a file that grows is laid out in as few contiguous runs as the
+   free space allows.  Blocks outside the range stay holes.  If
+   DELAYED is not null, the holes are the delayed blocks of that inode,
+   which get the new sectors in place of zeros, out of its
+   reservation.  If UNWRITTEN, the new data blocks are marked
+   unwritten instead of zeroed. **/
+static bool inode_allocate(struct inode_disk *disk_inode, size_t first, size_t end,
+                           block_sector_t owner, block_sector_t hint, struct inode *delayed,
+                           bool unwritten) {
+  struct extent ext = { 0, 0, hint, end, owner, delayed, unwritten };
+  bool success = true;
+
+  if (end > MAX_BLOCKS) {
+    // not enough space
+    return false;
+  }
 
   // write to the direct blocks
-  for (size_t i = 0; i < direct_ct; i++) {
-    if (disk_inode->direct_blocks[i] == 0) {
-      // write to the "1" free direct block
-      // printf("(inode_allocate) attempting direct allocation (index %d)!\n", i);
-      if (!free_map_allocate(1, &disk_inode->direct_blocks[i])) {
-        // failed to allocate
-        return false;
-      }
-      // init the block's values to zero
-      buffer_cache_write(disk_inode->direct_blocks[i], zero, 0, BLOCK_SECTOR_SIZE);
-    }
+  for (size_t i = first; i < end && i < DIRECT_COUNT && success; i++) {
+    success = allocate_data_sector(&disk_inode->direct_blocks[i], i, &ext);
   }
 
   // write to the indirect block
-  if (indirect_ct > 0) {
-    block_sector_t indirect_blocks[INDIRECT_COUNT];
-    if (disk_inode->indirect_block == 0) {
-      if (!free_map_allocate(1, &disk_inode->indirect_block)) {
-        return false;
-      }
-      buffer_cache_write(disk_inode->indirect_block, zero, 0, BLOCK_SECTOR_SIZE);
-    }
-    // read and write (zeroed) indirect block
-    buffer_cache_read(disk_inode->indirect_block, indirect_blocks, 0, BLOCK_SECTOR_SIZE);
-    for (size_t i = 0; i < indirect_ct; i++) {
-      if (indirect_blocks[i] == 0) {
-        if (!free_map_allocate(1, &indirect_blocks[i])) {
-          return false;
-        }
-        buffer_cache_write(indirect_blocks[i], zero, 0, BLOCK_SECTOR_SIZE);
-      }
+  size_t lo = first > DIRECT_COUNT ? first : DIRECT_COUNT;
+  size_t hi = end < DBL_INDIRECT_FIRST ? end : DBL_INDIRECT_FIRST;
+  if (success && lo < hi) {
+    success = allocate_index_block(&disk_inode->indirect_block, lo - DIRECT_COUNT, lo,
+                                   hi - lo, &ext);
+  }
+
+  // write to the double indirect block, one indirect block at a time
+  lo = first > DBL_INDIRECT_FIRST ? first : DBL_INDIRECT_FIRST;
+  hi = end < TPL_INDIRECT_FIRST ? end : TPL_INDIRECT_FIRST;
+  if (success && lo < hi) {
+    success = allocate_dbl_indirect_block(&disk_inode->double_indirect_block,
+                                          DBL_INDIRECT_FIRST, lo, hi, &ext);
+  }
+
+  // write to the triple indirect block, one double indirect block at a time
+  lo = first > TPL_INDIRECT_FIRST ? first : TPL_INDIRECT_FIRST;
+  if (success && lo < end) {
+    success = allocate_sector(&disk_inode->triple_indirect_block, &ext, ext.hint);
+  }
+  if (success && lo < end) {
+    struct buffer_block *block = buffer_cache_get(disk_inode->triple_indirect_block);
+    block_sector_t *dbl_blocks = (block_sector_t *) block->buf;
+    while (lo < end && success) {
+      size_t slot = (lo - TPL_INDIRECT_FIRST) / DBL_INDIRECT_SPAN;
+      size_t base = TPL_INDIRECT_FIRST + slot * DBL_INDIRECT_SPAN;
+      hi = end < base + DBL_INDIRECT_SPAN ? end : base + DBL_INDIRECT_SPAN;
+      success = allocate_dbl_indirect_block(&dbl_blocks[slot], base, lo, hi, &ext);
+      lo = hi;
     }
-    buffer_cache_write(disk_inode->indirect_block, indirect_blocks, 0, BLOCK_SECTOR_SIZE);
+    buffer_cache_put_owned(block, owner, true);
   }
 
-  // write to the double indirect block
-  if (dbl_indirect_ct > 0) {
-    block_sector_t doubly_indirect_blocks[INDIRECT_COUNT];
-    if (disk_inode->double_indirect_block == 0) {
-      if (!free_map_allocate(1, &disk_inode->double_indirect_block)) {
-        return false;
-      }
-      buffer_cache_write(disk_inode->double_indirect_block, zero, 0, BLOCK_SECTOR_SIZE);
-    }
-    // read and write (zeroed) double indirect block
-    buffer_cache_read(disk_inode->double_indirect_block, doubly_indirect_blocks, 0, BLOCK_SECTOR_SIZE);
-    for (size_t i = 0; i < dbl_indirect_ct; i++) {
-      if (doubly_indirect_blocks[i] == 0) {
-        if (!free_map_allocate(1, &doubly_indirect_blocks[i])) {
-          return false;
-        }
-        buffer_cache_write(doubly_indirect_blocks[i], zero, 0, BLOCK_SECTOR_SIZE);
-      }
+  // Give back whatever was reserved but not needed
+  if (ext.left > 0) {
+    free_map_release(ext.next, ext.left);
+  }
+  return success;
+}
+
+/** Releases the sectors listed in the index block at INDEX_SECTOR,
+   skipping holes, then the index block itself. **/
+static void deallocate_index_block(block_sector_t index_sector) {
+  if (index_sector == 0) {
+    return;
+  }
+  struct buffer_block *block = buffer_cache_get(index_sector);
+  block_sector_t *slots = (block_sector_t *) block->buf;
+  for (size_t i = 0; i < INDIRECT_COUNT; i++) {
+    if (slots[i] != 0) {
+      free_map_release(slots[i] & ~UNWRITTEN, 1);
     }
-    buffer_cache_write(disk_inode->double_indirect_block, doubly_indirect_blocks, 0, BLOCK_SECTOR_SIZE);
   }
+  buffer_cache_put(block, false);
+  free_map_release(index_sector, 1);
+}
 
-  // printf("(inode_allocate) finished!\n");
-  return true;
+/** Releases the index blocks under the double indirect block at
+   DBL_SECTOR, and the data blocks they list, then the double indirect
+   block itself. **/
+static void deallocate_dbl_indirect_block(block_sector_t dbl_sector) {
+  if (dbl_sector == 0) {
+    return;
+  }
+  struct buffer_block *block = buffer_cache_get(dbl_sector);
+  block_sector_t *indirect_blocks = (block_sector_t *) block->buf;
+  for (size_t i = 0; i < INDIRECT_COUNT; i++) {
+    deallocate_index_block(indirect_blocks[i]);
+  }
+  buffer_cache_put(block, false);
+  free_map_release(dbl_sector, 1);
 }
 
+/** Deallocate the blocks for the inode.  Walks the whole block map
+   rather than trusting the length, since holes may be anywhere and
+   a failed write may leave blocks allocated past the end. **/
+static void inode_deallocate(struct inode_disk *disk_inode) {
+  // inline data takes no blocks
+  if (disk_inode->inline_data) {
+    return;
+  }
 
-/** Deallocate the blocks for the inode**/
-static bool inode_deallocate(struct inode_disk *disk_inode, off_t length) { 
-  
-  // get sector ct
-  size_t sector_ct = bytes_to_sectors(length);
-  size_t direct_ct = sector_ct > DIRECT_COUNT ? DIRECT_COUNT : sector_ct;
-  sector_ct -= direct_ct;
-  size_t indirect_ct = sector_ct > INDIRECT_COUNT ? INDIRECT_COUNT : sector_ct;
-  sector_ct -= indirect_ct;
-  size_t dbl_indirect_ct = bytes_to_sectors(sector_ct);
-  
   // finally release the data
-  for (int i = 0; i < direct_ct; i++) {
-    free_map_release(disk_inode->direct_blocks[i], 1);
+  for (size_t i = 0; i < DIRECT_COUNT; i++) {
+    if (disk_inode->direct_blocks[i] != 0) {
+      free_map_release(disk_inode->direct_blocks[i] & ~UNWRITTEN, 1);
+    }
   }
 
   // indirect
-  if (indirect_ct > 0) {
-    block_sector_t indirect_blocks[INDIRECT_COUNT];
-    buffer_cache_read(disk_inode->indirect_block, indirect_blocks, 0, BLOCK_SECTOR_SIZE);
-    for (size_t i = 0; i < indirect_ct; i++) {
-      free_map_release(indirect_blocks[i], 1);
+  deallocate_index_block(disk_inode->indirect_block);
+
+  // double indirect
+  deallocate_dbl_indirect_block(disk_inode->double_indirect_block);
+
+  // triple indirect
+  if (disk_inode->triple_indirect_block != 0) {
+    struct buffer_block *block = buffer_cache_get(disk_inode->triple_indirect_block);
+    block_sector_t *dbl_blocks = (block_sector_t *) block->buf;
+    for (size_t i = 0; i < INDIRECT_COUNT; i++) {
+      deallocate_dbl_indirect_block(dbl_blocks[i]);
     }
-    free_map_release(disk_inode->indirect_block, 1);
+    buffer_cache_put(block, false);
+    free_map_release(disk_inode->triple_indirect_block, 1);
   }
+}
 
-  // double indirect
-  if (dbl_indirect_ct > 0) {
-    block_sector_t doubly_indirect_blocks[INDIRECT_COUNT];
-    buffer_cache_read(disk_inode->double_indirect_block, doubly_indirect_blocks, 0, BLOCK_SECTOR_SIZE);
-    for (size_t i = 0; i < dbl_indirect_ct; i++) {
-      block_sector_t indirect_block;
-      buffer_cache_read(doubly_indirect_blocks[i], &indirect_block, 0, BLOCK_SECTOR_SIZE);
-      block_sector_t indirect_blocks[INDIRECT_COUNT];
-      buffer_cache_read(indirect_block, indirect_blocks, 0, BLOCK_SECTOR_SIZE);
-      for (size_t j = 0; j < INDIRECT_COUNT; j++) {
-        free_map_release(indirect_blocks[j], 1);
-      }
-      free_map_release(indirect_block, 1);
+/** Returns the most sectors delayed data block INDEX can need: its
+   own, plus any index blocks that map it. **/
+static size_t delay_cost(off_t index) {
+  return 1 + (index >= DIRECT_COUNT) + (index >= DBL_INDIRECT_FIRST)
+         + (index >= TPL_INDIRECT_FIRST);
+}
+
+/** Returns how many index blocks on the way to data block INDEX
+   aren't on the way to INODE's delayed blocks, POS being where INDEX
+   goes among them.  Blocks that share an index block are next to
+   each other in the list, so the neighbors tell. **/
+static size_t delay_new_index_blocks(const struct inode *inode, size_t pos, off_t index) {
+  size_t n = 0;
+  for (int level = 1; level <= 3; level++) {
+    off_t id = index_block_id(index, level);
+    if (id != -1
+        && (pos == 0 || index_block_id(inode->delayed[pos - 1].index, level) != id)
+        && (pos == inode->delayed_cnt || index_block_id(inode->delayed[pos].index, level) != id)) {
+      n++;
     }
-    free_map_release(disk_inode->double_indirect_block, 1);
   }
-  
+  return n;
+}
+
+/** Turns the holes among the CNT blocks of INODE starting at FIRST,
+   whose sectors are in SECTORS, into delayed blocks, storing their
+   temporary sectors into SECTORS.  Returns false, with some holes
+   left, if INODE or the cache has as many delayed blocks as it may,
+   if placing them would take too many index blocks, or if the free
+   map can't set aside room for them.  The caller must hold INODE's
+   data lock for writing. **/
+static bool delay_holes(struct inode *inode, off_t first, size_t cnt, block_sector_t *sectors) {
+  for (size_t i = 0; i < cnt; i++) {
+    if (sectors[i] != 0) {
+      continue;
+    }
+    size_t cost = delay_cost(first + i);
+    size_t pos = delayed_find(inode, first + i);
+    size_t index_cnt = delay_new_index_blocks(inode, pos, first + i);
+    if (inode->delayed_cnt >= DELAY_MAX
+        || inode->delay_index_cnt + index_cnt > DELAY_INDEX_MAX
+        || !free_map_reserve(cost)) {
+      return false;
+    }
+    if (!buffer_cache_add_temp(inode->sector, &sectors[i])) {
+      free_map_unreserve(cost);
+      return false;
+    }
+    if (inode->delayed_cnt == 0) {
+      inode->delayed_since = timer_ticks();
+    }
+    memmove(&inode->delayed[pos + 1], &inode->delayed[pos],
+            (inode->delayed_cnt - pos) * sizeof *inode->delayed);
+    inode->delayed[pos].index = first + i;
+    inode->delayed[pos].temp = sectors[i];
+    inode->delayed_cnt++;
+    inode->delay_reserved += cost;
+    inode->delay_index_cnt += index_cnt;
+  }
   return true;
 }
 
+/** Gives INODE's delayed blocks sectors, one extent for each run of
+   consecutive blocks, out of the room reserved for them, after which
+   they are written back like any other block.  Returns true if none
+   are left.  The caller must hold INODE's data lock for writing,
+   inside a journal handle. **/
+static bool delayed_place(struct inode *inode) {
+  size_t i = 0, kept = 0;
+  bool success = true;
+
+  if (inode->delayed_cnt == 0) {
+    return true;
+  }
+  while (i < inode->delayed_cnt && success) {
+    size_t j = i + 1;
+    while (j < inode->delayed_cnt && inode->delayed[j].index == inode->delayed[j - 1].index + 1) {
+      j++;
+    }
+    off_t first = inode->delayed[i].index;
+    block_sector_t hint = first > 0 ? get_index_sector(inode, first - 1) & ~UNWRITTEN : 0;
+    hint = hint != 0 ? hint + 1 : inode->sector + 1;
+    success = inode_allocate(&inode->data, first, inode->delayed[j - 1].index + 1,
+                             inode->sector, hint, inode, false);
+    translation_reset(inode);
+    i = j;
+  }
+  write_disk_inode(inode);
+
+  // Keep the ones that didn't get a sector
+  inode->delay_index_cnt = 0;
+  for (i = 0; i < inode->delayed_cnt; i++) {
+    if (inode->delayed[i].temp != 0) {
+      inode->delayed[kept++] = inode->delayed[i];
+    }
+  }
+  inode->delayed_cnt = 0;
+  while (inode->delayed_cnt < kept) {
+    inode->delay_index_cnt += delay_new_index_blocks(inode, inode->delayed_cnt,
+                                                     inode->delayed[inode->delayed_cnt].index);
+    inode->delayed_cnt++;
+  }
+  if (kept == 0) {
+    free_map_unreserve(inode->delay_reserved);
+    inode->delay_reserved = 0;
+  }
+  return kept == 0;
+}
+
+/** Throws away INODE's delayed blocks and the room reserved for
+   them, once nothing can read them any more. **/
+static void delayed_drop(struct inode *inode) {
+  for (size_t i = 0; i < inode->delayed_cnt; i++) {
+    buffer_cache_drop_temp(inode->delayed[i].temp);
+  }
+  inode->delayed_cnt = 0;
+  inode->delay_index_cnt = 0;
+  free_map_unreserve(inode->delay_reserved);
+  inode->delay_reserved = 0;
+}
+
+/** Gives INODE's delayed blocks sectors, returning true if none are
+   left. **/
+static bool inode_place_delayed(struct inode *inode) {
+  bool success;
+
+  // The inode and the index blocks on the way to them
+  journal_begin(1 + DELAY_INDEX_MAX);
+  rwlock_acquire_write(&inode->rw);
+  success = delayed_place(inode);
+  rwlock_release_write(&inode->rw);
+  journal_end();
+  return success;
+}
+
 /** Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  The data is all one hole, so nothing but the inode is
+   allocated until it is written.
    Returns true if successful.
-   Returns false if memory or disk allocation fails. */
+   Returns false if memory allocation fails or LENGTH is too big. */
 bool
 inode_create (block_sector_t sector, off_t length, int is_dir)
 {
@@ -279,17 +844,27 @@ inode_create (block_sector_t sector, off_t length, int is_dir)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
+  /* Whatever used to be at SECTOR, a closed copy of it is stale. */
+  lock_acquire (&inode_table_lock);
+  struct inode *stale = inode_lookup (sector);
+  if (stale != NULL)
+    {
+      ASSERT (stale->open_cnt == 0);
+      inode_forget (stale);
+    }
+  lock_release (&inode_table_lock);
+
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
       disk_inode->directory = is_dir;
-      // Allocate the blocks for the inode
-      if (inode_allocate(disk_inode, disk_inode->length))
+      disk_inode->inline_data = length <= (off_t) INLINE_MAX;
+      if (bytes_to_sectors (length) <= MAX_BLOCKS)
         {
           // write to the cache
-          buffer_cache_write(sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
+          buffer_cache_write(sector, disk_inode, 0, BLOCK_SECTOR_SIZE, sector, true);
           success = true; 
         }
       free (disk_inode);
@@ -304,35 +879,63 @@ inode_create (block_sector_t sector, off_t length, int is_dir)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  lock_acquire (&inode_table_lock);
+
+  /* Check whether this inode is already in memory. */
+  inode = inode_lookup (sector);
+  if (inode != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
+      if (inode->open_cnt++ == 0)
         {
-          inode_reopen (inode);
-          return inode; 
+          list_remove (&inode->elem);
+          closed_inode_cnt--;
         }
+      while (inode->loading)
+        cond_wait (&inode_loaded, &inode_table_lock);
+      lock_release (&inode_table_lock);
+      return inode;
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&inode_table_lock);
+      return NULL;
+    }
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
+  hash_insert (&inodes, &inode->hash_elem);
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-
-  // Try to get the inode from the buffer cache
+  inode->loading = true;
+  rwlock_init (&inode->rw);
+  lock_init (&inode->dir_lock);
+  lock_init (&inode->xl_lock);
+  inode->ra_next = 0;
+  inode->ra_limit = 0;
+  inode->ra_window = 0;
+  inode->xl_first = -1;
+  inode->xl_dbl_slot = -1;
+  inode->delayed_cnt = 0;
+  inode->delay_reserved = 0;
+  inode->delay_index_cnt = 0;
+  inode->delayed_since = 0;
+  inode->delay_pinned = false;
+  inode->meta_txn = 0;
+
+  /* Read the inode without holding up the rest of the table.
+     Anyone else opening it meanwhile waits until it is loaded. */
+  lock_release (&inode_table_lock);
   buffer_cache_read (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+  lock_acquire (&inode_table_lock);
+  inode->loading = false;
+  cond_broadcast (&inode_loaded, &inode_table_lock);
+  lock_release (&inode_table_lock);
   return inode;
 }
 
@@ -341,7 +944,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&inode_table_lock);
+      inode->open_cnt++;
+      lock_release (&inode_table_lock);
+    }
   return inode;
 }
 
@@ -362,21 +969,57 @@ inode_close (struct inode *inode)
   if (inode == NULL)
     return;
 
+  /* The last opener of a file that is kept gives its delayed blocks
+     sectors.  That can't be done with the table locked, so another
+     thread may open the file and write more of them meanwhile, which
+     get placed in turn once this is the last opener again.  Should
+     the free map not find the room it promised, the file stays open
+     for inode_flush_delayed() to try again: a kept file's data is
+     never dropped. */
+  lock_acquire (&inode_table_lock);
+  while (inode->open_cnt == 1 && !inode->removed && inode->delayed_cnt > 0)
+    {
+      bool placed;
+
+      lock_release (&inode_table_lock);
+      placed = inode_place_delayed (inode);
+      lock_acquire (&inode_table_lock);
+      if (!placed && inode->open_cnt == 1 && !inode->removed
+          && inode->delayed_cnt > 0)
+        {
+          inode->delay_pinned = true;
+          lock_release (&inode_table_lock);
+          return;
+        }
+    }
+
   /* Release resources if this was the last opener. */
   if (--inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
+      /* Deallocate blocks if removed.  Nobody can find INODE once
+         it is out of the table, so that needs no lock.  Its delayed
+         blocks never had sectors, so they just go. */
       if (inode->removed) 
         {
+          hash_delete (&inodes, &inode->hash_elem);
+          lock_release (&inode_table_lock);
+          delayed_drop (inode);
           free_map_release (inode->sector, 1);
-          inode_deallocate(&inode->data, inode->data.length);
+          inode_deallocate(&inode->data);
+          free (inode);
+          return;
         }
 
-      free (inode); 
+      ASSERT (inode->delayed_cnt == 0);
+
+      /* Otherwise keep it around in case it is reopened soon,
+         forgetting the least recently closed inode to make room. */
+      list_push_front (&closed_inodes, &inode->elem);
+      if (++closed_inode_cnt > CLOSED_INODES_MAX)
+        inode_forget (list_entry (list_back (&closed_inodes),
+                                  struct inode, elem));
     }
+  lock_release (&inode_table_lock);
 }
 
 /** Marks INODE to be deleted when it is closed by the last caller who
@@ -385,37 +1028,125 @@ void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
+  lock_acquire (&inode_table_lock);
   inode->removed = true;
+  lock_release (&inode_table_lock);
 }
 
-/** Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
-   Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
-off_t
-inode_read_at(struct inode *inode, void *buffer_, off_t size, off_t offset)
+/** Updates INODE's read-ahead state for a read of the blocks
+   FIRST...LAST and queues prefetches for the blocks that follow.
+   The window doubles on each read that picks up where the last one
+   left off and collapses on any other access. */
+static void
+inode_read_ahead (struct inode *inode, off_t first, off_t last)
+{
+  if (first == inode->ra_next || first == inode->ra_next - 1)
+    {
+      inode->ra_window = inode->ra_window == 0 ? READ_AHEAD_MIN
+                         : inode->ra_window * 2;
+      if (inode->ra_window > READ_AHEAD_MAX)
+        inode->ra_window = READ_AHEAD_MAX;
+    }
+  else
+    {
+      inode->ra_window = 0;
+      inode->ra_limit = 0;
+    }
+  inode->ra_next = last + 1;
+
+  off_t end = inode->ra_next + inode->ra_window;
+  off_t file_blocks = bytes_to_sectors (inode_length (inode));
+  if (end > file_blocks)
+    end = file_blocks;
+  off_t block = inode->ra_limit > inode->ra_next ? inode->ra_limit : inode->ra_next;
+  for (; block < end; block++)
+    {
+      block_sector_t sector = byte_to_sector (inode, block * BLOCK_SECTOR_SIZE);
+      if (sector != 0 && (sector & UNWRITTEN) == 0)
+        buffer_cache_read_ahead (sector);
+    }
+  if (block > inode->ra_limit)
+    inode->ra_limit = block;
+}
+
+/** Reads SIZE bytes into BUFFER from the CNT sectors in SECTORS, as
+   if they were contiguous, starting OFS bytes into the first.  Holes
+   read as zeros without touching the cache or the disk. */
+static void
+read_sectors (const block_sector_t *sectors, size_t cnt, uint8_t *buffer,
+              int ofs, off_t size)
+{
+  size_t i = 0;
+
+  while (i < cnt && size > 0)
+    {
+      bool hole = sectors[i] == 0;
+      size_t j = i + 1;
+      off_t run_size;
+
+      while (j < cnt && (sectors[j] == 0) == hole)
+        j++;
+      run_size = (off_t) (j - i) * BLOCK_SECTOR_SIZE - ofs;
+      if (run_size > size)
+        run_size = size;
+      if (hole)
+        memset (buffer, 0, run_size);
+      else
+        buffer_cache_read_range (&sectors[i], buffer, ofs, run_size);
+      buffer += run_size;
+      size -= run_size;
+      ofs = 0;
+      i = j;
+    }
+}
+
+/** Does the work of inode_read_at(), with INODE's data lock held
+   for reading. */
+static off_t
+read_at(struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
   // printf("(inode_read_at) starting...(size:%u, offset:%u)\n", size, offset);
+
+  /* Inline data is right there in memory. */
+  if (inode->data.inline_data)
+    {
+      if (offset >= inode->data.length || size <= 0)
+        return 0;
+      bytes_read = inode->data.length - offset < size ? inode->data.length - offset : size;
+      memcpy (buffer, inode->data.inline_bytes + offset, bytes_read);
+      return bytes_read;
+    }
+
   while (size > 0)
   {
-    /* Disk sector to read, starting byte offset within sector. */
-    block_sector_t sector_idx = byte_to_sector(inode, offset);
-    int sector_ofs = offset % BLOCK_SECTOR_SIZE;
-
-    /* Bytes left in inode, bytes left in sector, lesser of the two. */
+    /* Bytes left in inode, lesser of that and the request. */
     off_t inode_left = inode_length(inode) - offset;
-    int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-    int min_left = inode_left < sector_left ? inode_left : sector_left;
-
-    /* Number of bytes to actually copy out of this sector. */
-    int chunk_size = size < min_left ? size : min_left;
+    off_t chunk_size = size < inode_left ? size : inode_left;
     if (chunk_size <= 0)
       break;
 
+    /* Translate up to IO_BATCH sectors at once, starting byte offset
+       within the first. */
+    block_sector_t sectors[IO_BATCH];
+    int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+    size_t sector_cnt = DIV_ROUND_UP(sector_ofs + chunk_size, BLOCK_SECTOR_SIZE);
+    if (sector_cnt > IO_BATCH) {
+      sector_cnt = IO_BATCH;
+      chunk_size = IO_BATCH * BLOCK_SECTOR_SIZE - sector_ofs;
+    }
+    get_index_sectors(inode, offset / BLOCK_SECTOR_SIZE, sector_cnt, sectors);
 
-    /* Read the required part of the sector directly into caller's buffer. */
-    buffer_cache_read(sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
+    /* Unwritten blocks read like holes. */
+    for (size_t i = 0; i < sector_cnt; i++) {
+      if (sectors[i] & UNWRITTEN) {
+        sectors[i] = 0;
+      }
+    }
+
+    /* Read them directly into caller's buffer. */
+    read_sectors(sectors, sector_cnt, buffer + bytes_read, sector_ofs, chunk_size);
 
     /* Advance to the next chunk. */
     size -= chunk_size;
@@ -423,56 +1154,205 @@ inode_read_at(struct inode *inode, void *buffer_, off_t size, off_t offset)
     bytes_read += chunk_size;
     //printf(" | done \n");
   }
+
+  /* Prefetch what a sequential reader will want next. */
+  if (bytes_read > 0)
+    inode_read_ahead (inode, (offset - bytes_read) / BLOCK_SECTOR_SIZE,
+                      (offset - 1) / BLOCK_SECTOR_SIZE);
   // printf("(inode_read_at) bytesread %u\n", bytes_read);
   return bytes_read;
 }
 
-/** Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
-   Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
-off_t
-inode_write_at(struct inode *inode, const void *buffer_, off_t size, off_t offset)
+static off_t write_at(struct inode *, const void *, off_t size, off_t offset);
+
+/** Moves INODE's inline data out to a data block, switching it to
+   the block map.  Returns false, leaving INODE as it was, if the
+   disk is full or memory runs out.  The caller must hold INODE's
+   data lock for writing. */
+static bool
+inode_promote (struct inode *inode)
+{
+  off_t length = inode->data.length;
+  uint8_t *data = malloc (INLINE_MAX);
+  bool success;
+
+  if (data == NULL)
+    return false;
+  memcpy (data, inode->data.inline_bytes, INLINE_MAX);
+
+  /* An empty block map is all holes, so only the bytes written
+     back below take space. */
+  memset (inode->data.inline_bytes, 0, INLINE_MAX);
+  inode->data.inline_data = false;
+  inode->data.length = 0;
+  translation_reset (inode);
+  success = length == 0 || write_at (inode, data, length, 0) == length;
+  if (!success)
+    {
+      /* The write allocated nothing, or the one data block it did
+         is released with the block map. */
+      inode_deallocate (&inode->data);
+      memcpy (inode->data.inline_bytes, data, INLINE_MAX);
+      inode->data.inline_data = true;
+      translation_reset (inode);
+    }
+  inode->data.length = length;
+  write_disk_inode (inode);
+  free (data);
+  return success;
+}
+
+/** Takes the UNWRITTEN flag off the blocks preallocated by
+   inode_fallocate() among the CNT blocks of INODE starting at FIRST,
+   whose sectors are in SECTORS, before they are written with SIZE
+   bytes starting OFS bytes into the first.  The parts of them the
+   write doesn't cover are zeroed.  The caller must hold INODE's data
+   lock for writing. */
+static void
+mark_written (struct inode *inode, off_t first, size_t cnt,
+              block_sector_t *sectors, int ofs, off_t size)
+{
+  bool changed = false;
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    if (sectors[i] & UNWRITTEN)
+      {
+        off_t start = (off_t) i * BLOCK_SECTOR_SIZE;
+
+        sectors[i] &= ~UNWRITTEN;
+        if (start < ofs || start + BLOCK_SECTOR_SIZE > ofs + size)
+          buffer_cache_put_owned (buffer_cache_get_zero (sectors[i]),
+                                  inode->sector, false);
+        set_index_sector (inode, first + i, sectors[i]);
+        changed = true;
+      }
+  if (changed)
+    {
+      translation_reset (inode);
+      write_disk_inode (inode);
+    }
+}
+
+/** Returns true if INODE's data is metadata, to be journaled: the
+   contents of directories and of the free map are. */
+static bool
+inode_is_meta (const struct inode *inode)
+{
+  return inode->data.directory || inode->sector == FREE_MAP_SECTOR;
+}
+
+/** Returns the most blocks of a journal transaction that writing or
+   preallocating data blocks FIRST...FIRST + CNT - 1 of a file may
+   dirty: its inode, the index blocks on the way, the data blocks too
+   if they are metadata (META), along with block 0 should inline data
+   move out to it, and the index blocks of the delayed blocks placed
+   first. */
+static size_t
+write_credits (off_t first, size_t cnt, bool meta)
+{
+  return 1 + index_blocks_spanned (first, cnt) + (meta ? cnt + 1 : 0)
+         + DELAY_INDEX_MAX;
+}
+
+/** Does the work of inode_write_at(), with INODE's data lock held
+   for writing. */
+static off_t
+write_at(struct inode *inode, const void *buffer_, off_t size, off_t offset)
 {
   // printf("(inode_write_at) start!\n");
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
+  bool meta = inode_is_meta(inode);
 
-  if (inode->deny_write_cnt != 0) {
+  if (inode->deny_write_cnt != 0 || size <= 0) {
     return 0;
   }
 
-  // extend the file
-  off_t new_length = offset + size;
-  if (new_length > inode->data.length) {
-    inode_allocate(&inode->data, new_length);
-    inode->data.length = new_length;
-    buffer_cache_write(inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+  if (inode->data.inline_data && offset + size <= (off_t) INLINE_MAX) {
+    // Still fits: update the inode sector and nothing else
+    memcpy(inode->data.inline_bytes + offset, buffer, size);
+    if (offset + size > inode->data.length) {
+      inode->data.length = offset + size;
+    }
+    write_disk_inode(inode);
+    return size;
+  }
+  if (inode->data.inline_data && !inode_promote(inode)) {
+    return 0;
   }
 
   while (size > 0)
   {
     // printf("(inode_write_at) in loop\n");
-    /* Sector to write, starting byte offset within sector. */
-    block_sector_t sector_idx = byte_to_sector(inode, offset);
-    int sector_ofs = offset % BLOCK_SECTOR_SIZE;
-
-    /* Bytes left in inode, bytes left in sector, lesser of the two. */
-    off_t inode_left = inode_length(inode) - offset;
-    int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-    int min_left = inode_left < sector_left ? inode_left : sector_left;
+    off_t chunk_size = size;
+    off_t first = offset / BLOCK_SECTOR_SIZE;
 
-    /* Number of bytes to actually write into this sector. */
-    int chunk_size = size < min_left ? size : min_left;
-
-    if (chunk_size <= 0) {
-      // printf("(inode_write_at) chunk_size <= 0\n");
+    if (first >= MAX_BLOCKS) {
+      // printf("(inode_write_at) file is as big as it gets\n");
       break;
     }
 
-    /* Write the required part of the sector directly into the cache entry. */
-    buffer_cache_write(sector_idx, buffer + bytes_written, sector_ofs, chunk_size);
+    /* Translate up to IO_BATCH sectors at once, starting byte offset
+       within the first. */
+    block_sector_t sectors[IO_BATCH];
+    int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+    size_t sector_cnt = DIV_ROUND_UP(sector_ofs + chunk_size, BLOCK_SECTOR_SIZE);
+    if (sector_cnt > IO_BATCH) {
+      sector_cnt = IO_BATCH;
+      chunk_size = IO_BATCH * BLOCK_SECTOR_SIZE - sector_ofs;
+    }
+    if (first + (off_t) sector_cnt > MAX_BLOCKS) {
+      sector_cnt = MAX_BLOCKS - first;
+      chunk_size = sector_cnt * BLOCK_SECTOR_SIZE - sector_ofs;
+    }
+    get_index_sectors(inode, first, sector_cnt, sectors);
+
+    /* Fill the holes about to be written, for the rest of the write at
+       once so that it is laid out in as few runs as possible.  A
+       regular file's new blocks just get delayed, while it is allowed
+       some; otherwise its delayed blocks are placed first, so that
+       allocation sees them. */
+    size_t hole = 0;
+    while (hole < sector_cnt && sectors[hole] != 0) {
+      hole++;
+    }
+    if (hole < sector_cnt && !meta && delay_holes(inode, first, sector_cnt, sectors)) {
+      hole = sector_cnt;
+    }
+    if (hole < sector_cnt) {
+      if (!delayed_place(inode)) {
+        break;
+      }
+      off_t end = DIV_ROUND_UP(offset + size, BLOCK_SECTOR_SIZE);
+      block_sector_t hint = first > 0 ? get_index_sector(inode, first - 1) & ~UNWRITTEN : 0;
+      hint = hint != 0 ? hint + 1 : inode->sector + 1;
+      inode_allocate(&inode->data, first, end < MAX_BLOCKS ? end : MAX_BLOCKS,
+                     inode->sector, hint, NULL, false);
+      translation_reset(inode);
+      write_disk_inode(inode);
+      get_index_sectors(inode, first, sector_cnt, sectors);
+
+      // Out of space: write only up to the first block still missing
+      hole = 0;
+      while (hole < sector_cnt && sectors[hole] != 0) {
+        hole++;
+      }
+      if (hole == 0) {
+        break;
+      }
+      if (hole < sector_cnt) {
+        sector_cnt = hole;
+        chunk_size = sector_cnt * BLOCK_SECTOR_SIZE - sector_ofs;
+      }
+    }
+
+    /* Preallocated blocks are being written for the first time. */
+    mark_written(inode, first, sector_cnt, sectors, sector_ofs, chunk_size);
+
+    /* Write them directly into the cache entries. */
+    buffer_cache_write_range(sectors, buffer + bytes_written, sector_ofs, chunk_size,
+                             inode->sector, meta);
 
     /* Advance to the next chunk. */
     size -= chunk_size;
@@ -483,7 +1363,7 @@ inode_write_at(struct inode *inode, const void *buffer_, off_t size, off_t offse
   /* Update inode length if we have written past the previous end of the inode. */
   if (offset > inode->data.length) {
     inode->data.length = offset;
-    buffer_cache_write(inode->sector, &inode->data, 0, sizeof(inode->data));
+    write_disk_inode(inode);
   }
 
   // printf("(inode_write_at) bytes written %u\n", bytes_written);
@@ -491,13 +1371,216 @@ inode_write_at(struct inode *inode, const void *buffer_, off_t size, off_t offse
   return bytes_written;
 }
 
+/** Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
+   Returns the number of bytes actually read, which may be less
+   than SIZE if an error occurs or end of file is reached.
+   Any number of threads may read INODE at once. */
+off_t
+inode_read_at (struct inode *inode, void *buffer, off_t size, off_t offset)
+{
+  off_t bytes_read;
+
+  rwlock_acquire_read (&inode->rw);
+  bytes_read = read_at (inode, buffer, size, offset);
+  rwlock_release_read (&inode->rw);
+  return bytes_read;
+}
+
+/** Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+   Returns the number of bytes actually written, which may be
+   less than SIZE if the disk fills up or the file reaches its
+   maximum size.  Writing past end of file extends INODE, leaving a
+   hole between the old end and OFFSET; only the blocks actually
+   written are allocated.  Each WRITE_CHUNK blocks of the write are
+   one journal transaction, so that a crash leaves a prefix of it, and
+   exclude reads and other writes of INODE, but not of other
+   inodes. */
+off_t
+inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+                off_t offset)
+{
+  const uint8_t *buffer = buffer_;
+  off_t bytes_written = 0;
+
+  while (size > 0)
+    {
+      int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      off_t chunk_size = WRITE_CHUNK * BLOCK_SECTOR_SIZE - sector_ofs;
+      off_t written;
+
+      if (chunk_size > size)
+        chunk_size = size;
+      journal_begin (write_credits (offset / BLOCK_SECTOR_SIZE,
+                                    DIV_ROUND_UP (sector_ofs + chunk_size,
+                                                  BLOCK_SECTOR_SIZE),
+                                    inode_is_meta (inode)));
+      rwlock_acquire_write (&inode->rw);
+      written = write_at (inode, buffer + bytes_written, chunk_size, offset);
+      rwlock_release_write (&inode->rw);
+      journal_end ();
+
+      bytes_written += written;
+      if (written < chunk_size)
+        break;
+      size -= written;
+      offset += written;
+    }
+  return bytes_written;
+}
+
+/** Allocates the blocks holding bytes OFFSET...OFFSET + LEN - 1 of
+   INODE that are still holes, as contiguously as the free space
+   allows, and extends INODE to OFFSET + LEN bytes if it is shorter.
+   The new blocks are marked unwritten rather than zeroed: they read
+   as zeros, and writing them later takes no allocation.  Returns
+   false if INODE is a directory, writes to it are denied, the range
+   is past the largest file size or the disk is full, in which case
+   some of the blocks may be allocated all the same. */
+bool
+inode_fallocate (struct inode *inode, off_t offset, off_t len)
+{
+  off_t end, first, end_block;
+  bool success;
+
+  if (offset < 0 || len <= 0 || len > INT32_MAX - offset)
+    return false;
+  end = offset + len;
+  first = offset / BLOCK_SECTOR_SIZE;
+  end_block = bytes_to_sectors (end);
+
+  /* One journal transaction for each WRITE_CHUNK blocks, like a
+     write.  The length changes only in the last, so a crash in
+     between leaves at worst blocks allocated past the end. */
+  do
+    {
+      off_t chunk_end = end_block - first > WRITE_CHUNK ? first + WRITE_CHUNK : end_block;
+
+      journal_begin (write_credits (first, chunk_end - first, false));
+      rwlock_acquire_write (&inode->rw);
+      success = (!inode->data.directory && inode->deny_write_cnt == 0
+                 && end_block <= MAX_BLOCKS);
+      if (success && inode->data.inline_data && end > (off_t) INLINE_MAX)
+        success = inode_promote (inode);
+
+      /* Place any delayed blocks first, so that allocation sees them. */
+      if (success && !inode->data.inline_data)
+        success = delayed_place (inode);
+      if (success && !inode->data.inline_data)
+        {
+          block_sector_t hint = first > 0 ? get_index_sector (inode, first - 1) & ~UNWRITTEN : 0;
+          hint = hint != 0 ? hint + 1 : inode->sector + 1;
+          success = inode_allocate (&inode->data, first, chunk_end,
+                                    inode->sector, hint, NULL, true);
+          translation_reset (inode);
+        }
+      first = chunk_end;
+      if (success && first == end_block && end > inode->data.length)
+        inode->data.length = end;
+      write_disk_inode (inode);
+      rwlock_release_write (&inode->rw);
+      journal_end ();
+    }
+  while (success && first < end_block);
+  return success;
+}
+
+/** Writes INODE's dirty data blocks, index blocks and on-disk inode
+   back to disk, waiting until they are there.  The data goes first,
+   and then the journal is committed, which puts the inode, its index
+   blocks and the free map safely in the log along with any other
+   metadata changed since the last commit: a block map that survives
+   a crash never points at blocks whose data didn't.  If DATA_ONLY,
+   the commit is left out when none of INODE's metadata changed since
+   the last one: its length and block map already survive a crash,
+   and only the overwritten data has to reach the disk.  Delayed
+   blocks are given sectors first, which changes the block map. */
+void
+inode_sync (struct inode *inode, bool data_only)
+{
+  uint32_t meta_txn;
+
+  if (inode->delayed_cnt > 0)
+    inode_place_delayed (inode);
+
+  /* Wait for any write in progress, so that it is synced whole. */
+  rwlock_acquire_read (&inode->rw);
+  buffer_cache_sync (inode->sector);
+  meta_txn = inode->meta_txn;
+  rwlock_release_read (&inode->rw);
+
+  if (!data_only || !journal_committed (meta_txn))
+    journal_commit ();
+}
+
+/** Gives sectors to the delayed blocks of every open file whose
+   oldest was written at least AGE ticks ago, so that the write-behind
+   thread can write them back.  Files already removed are left alone,
+   since their blocks never need any, unless inode_close() kept them
+   open to try again. */
+void
+inode_flush_delayed (int64_t age)
+{
+  struct inode *batch[DELAY_FLUSH_BATCH];
+  bool placed = true;
+  size_t n, i;
+
+  do
+    {
+      int64_t now = timer_ticks ();
+      struct hash_iterator it;
+
+      /* Closed inodes have no delayed blocks, so each one found is
+         open and can simply be reopened. */
+      n = 0;
+      lock_acquire (&inode_table_lock);
+      hash_first (&it, &inodes);
+      while (n < DELAY_FLUSH_BATCH && hash_next (&it))
+        {
+          struct inode *inode = hash_entry (hash_cur (&it), struct inode,
+                                            hash_elem);
+          if (inode->delayed_cnt > 0
+              && (inode->delay_pinned
+                  || (!inode->removed && now - inode->delayed_since >= age)))
+            {
+              ASSERT (inode->open_cnt > 0);
+              inode->open_cnt++;
+              batch[n++] = inode;
+            }
+        }
+      lock_release (&inode_table_lock);
+
+      for (i = 0; i < n; i++)
+        {
+          struct inode *inode = batch[i];
+          bool unpin;
+
+          placed = inode_place_delayed (inode) && placed;
+
+          /* Let go of the reference inode_close() kept, once it is
+             no longer needed. */
+          lock_acquire (&inode_table_lock);
+          unpin = inode->delay_pinned
+                  && (inode->delayed_cnt == 0 || inode->removed);
+          if (unpin)
+            inode->delay_pinned = false;
+          lock_release (&inode_table_lock);
+          if (unpin)
+            inode_close (inode);
+          inode_close (inode);
+        }
+    }
+  while (n == DELAY_FLUSH_BATCH && placed);
+}
+
 /** Disables writes to INODE.
    May be called at most once per inode opener. */
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rw);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rw);
 }
 
 /** Re-enables writes to INODE.
@@ -506,12 +1589,44 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rw);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rw);
+}
+
+/** Serializes changes to the entries of directory INODE.  The
+   directory code holds it across every lookup, addition and removal
+   in INODE, which makes them atomic and lets it work on INODE's
+   blocks in place, through inode_get_sector(), without the data
+   lock. */
+void
+inode_dir_lock (struct inode *inode)
+{
+  lock_acquire (&inode->dir_lock);
 }
 
-/** Returns the length, in bytes, of INODE's data. */
+/** Releases INODE's directory lock. */
+void
+inode_dir_unlock (struct inode *inode)
+{
+  lock_release (&inode->dir_lock);
+}
+
+/** Returns the sector holding byte offset POS of INODE, -1 if
+   INODE has no data at POS or keeps its data inline, or 0 if POS
+   lies in a hole, which reads as zeros and must be written with
+   inode_write_at().  Lets callers such as the directory code work
+   on INODE's blocks in place with buffer_cache_get(). */
+block_sector_t
+inode_get_sector (struct inode *inode, off_t pos)
+{
+  return byte_to_sector (inode, pos);
+}
+
+/** Returns the length, in bytes, of INODE's data.  Reads it without
+   locking, so a concurrent write may or may not be reflected. */
 off_t
 inode_length (const struct inode *inode)
 {
@@ -532,6 +1647,14 @@ inode_is_dir (const struct inode *inode)
   return inode->data.directory;
 }
 
+/* Returns if INODE keeps its data inline, so that it has no data
+   blocks to work on in place */
+bool
+inode_is_inline (const struct inode *inode)
+{
+  return inode->data.inline_data;
+}
+
 /* Returns if the file is removed or not */
 bool
 inode_is_removed (const struct inode *inode)
@@ -2,6 +2,7 @@
 #define FILESYS_INODE_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "filesys/off_t.h"
 #include "devices/block.h"
 
@@ -16,11 +17,18 @@ void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+bool inode_fallocate (struct inode *, off_t offset, off_t len);
+void inode_sync (struct inode *, bool data_only);
+void inode_flush_delayed (int64_t age);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
+void inode_dir_lock (struct inode *);
+void inode_dir_unlock (struct inode *);
 off_t inode_length (const struct inode *);
+block_sector_t inode_get_sector (struct inode *, off_t pos);
 
 bool inode_is_dir (const struct inode *inode);
+bool inode_is_inline (const struct inode *inode);
 bool inode_is_removed (const struct inode *inode);
 
 #endif /**< filesys/inode.h */
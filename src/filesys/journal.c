@@ -0,0 +1,530 @@
+#include "filesys/journal.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/** Identify the journal header, descriptors and commit records. */
+#define JOURNAL_MAGIC 0x4a524e4c
+#define DESCRIPTOR_MAGIC 0x4a445343
+#define COMMIT_MAGIC 0x4a434d54
+
+/** Size of the log made at format time: a fraction of the disk,
+   within bounds. */
+#define LOG_FRACTION 16
+#define LOG_MIN_SECTORS 128
+#define LOG_MAX_SECTORS 1024
+
+/** Most blocks in one transaction. */
+#define TXN_MAX JOURNAL_TXN_MAX
+
+/** The journal keeps metadata consistent across crashes.  Changes to
+   inodes, index blocks, directories and the free map are grouped
+   into transactions, each of them a run of operations bracketed by
+   journal_begin() and journal_end().  The buffer cache holds every
+   metadata block such an operation dirties in memory until the
+   transaction commits: then copies of the blocks go to the log, a
+   region reserved at format time, in one sequential write followed by
+   a commit record, and only after that may the blocks be written
+   home.  Many operations share each commit.  When the log fills up,
+   a checkpoint writes all the blocks home and starts it over.
+
+   Every block an operation dirties must fit in the transaction, or
+   the operation would not be atomic, so journal_begin() takes a
+   count of credits, the most blocks the operation may dirty, and
+   commits the running transaction first if it can't promise that
+   many.  Operations bigger than a transaction, such as long writes,
+   are split into several.  Room for the whole free map is kept in
+   every transaction, since the commit rewrites whatever changed of
+   it.
+
+   In the log, a transaction is a descriptor naming the home sectors
+   of the blocks, copies of the blocks in that order, and a commit
+   record.  After a crash, journal_open() copies the blocks of every
+   complete transaction home, oldest first. */
+
+/** On-disk journal header, at JOURNAL_SECTOR. */
+struct journal_header
+  {
+    unsigned magic;                     /**< JOURNAL_MAGIC. */
+    block_sector_t start;               /**< First sector of the log. */
+    uint32_t size;                      /**< Sectors in the log. */
+    uint32_t seq;                       /**< Number of the transaction at START. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 16];
+  };
+
+/** Starts a transaction in the log. */
+struct journal_descriptor
+  {
+    unsigned magic;                     /**< DESCRIPTOR_MAGIC. */
+    uint32_t seq;                       /**< Transaction number. */
+    uint32_t cnt;                       /**< Blocks that follow. */
+    block_sector_t sectors[TXN_MAX];    /**< Their home sectors. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 12 - TXN_MAX * sizeof (block_sector_t)];
+  };
+
+/** Ends a transaction in the log, which counts only if this made it
+   to disk intact. */
+struct journal_commit
+  {
+    unsigned magic;                     /**< COMMIT_MAGIC. */
+    uint32_t seq;                       /**< Transaction number. */
+    uint32_t cnt;                       /**< Blocks in the transaction. */
+    uint32_t checksum;                  /**< Of the descriptor and blocks. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 16];
+  };
+
+static bool enabled;                    /**< Journaling yet? */
+static struct journal_header header;    /**< Copy of the on-disk header. */
+static uint32_t next_seq;               /**< Number of the next commit. */
+static size_t head;                     /**< Where it goes, from START. */
+
+/** Blocks of the running transaction, held by the buffer cache. */
+static struct buffer_block *txn[TXN_MAX];
+static size_t txn_cnt;
+
+/** Blocks of the running transaction promised to the operations
+   under way and not dirtied by them yet. */
+static size_t txn_credits;
+
+/** Sectors of the free map file, which a commit may all rewrite. */
+static size_t map_sectors;
+
+/** Sectors with a copy in the log since the last checkpoint, or
+   held by the running transaction, which puts one there when it
+   commits.  They must not be reused for file data before the next
+   checkpoint, since a replay would write the copy over the data.
+   Marking them as the transaction takes them, rather than once it
+   is written, keeps the releases that the commit's free map flush
+   applies, and those applied under space pressure while the
+   transaction runs, away from them. */
+static struct bitmap *logged;
+
+/** Descriptor, blocks and commit record of a transaction being
+   written or replayed. */
+static uint8_t *stage;
+
+/** Protects TXN, TXN_CNT, TXN_CREDITS, LOGGED and the commit state
+   below. */
+static struct lock journal_lock;
+static int active_cnt;                  /**< Operations under way. */
+static bool committing;                 /**< A commit in progress? */
+static struct condition handles_done;   /**< Signaled when ACTIVE_CNT drops to 0. */
+static struct condition commit_done;    /**< Signaled when COMMITTING turns false. */
+
+static void commit (bool full);
+static void write_transaction (void);
+static void checkpoint (void);
+static void replay (void);
+static uint32_t checksum (const void *, size_t sectors);
+
+/** Initializes the journal module. */
+void
+journal_init (void)
+{
+  ASSERT (sizeof (struct journal_header) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct journal_descriptor) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct journal_commit) == BLOCK_SECTOR_SIZE);
+
+  lock_init (&journal_lock);
+  cond_init (&handles_done);
+  cond_init (&commit_done);
+  logged = bitmap_create (block_size (fs_device));
+  stage = malloc ((TXN_MAX + 2) * BLOCK_SECTOR_SIZE);
+  if (logged == NULL || stage == NULL)
+    PANIC ("can't allocate journal");
+
+  /* Operations need most of each transaction for themselves. */
+  map_sectors = DIV_ROUND_UP (block_size (fs_device), BLOCK_SECTOR_SIZE * 8);
+  if (map_sectors > TXN_MAX / 4)
+    PANIC ("file system device too big for the journal");
+}
+
+/** Reserves the log on a file system being formatted and writes an
+   empty journal header. */
+void
+journal_create (void)
+{
+  static const uint8_t zeros[BLOCK_SECTOR_SIZE];
+  size_t size = block_size (fs_device) / LOG_FRACTION;
+  size_t i;
+
+  if (size < LOG_MIN_SECTORS)
+    size = LOG_MIN_SECTORS;
+  if (size > LOG_MAX_SECTORS)
+    size = LOG_MAX_SECTORS;
+  if (!free_map_allocate (size, &header.start))
+    PANIC ("journal creation failed");
+  header.magic = JOURNAL_MAGIC;
+  header.size = size;
+  header.seq = 1;
+
+  /* Clear out whatever an earlier file system left there, so that
+     none of it can pass for a transaction. */
+  for (i = 0; i < size; i++)
+    block_write (fs_device, header.start + i, zeros);
+  block_write (fs_device, JOURNAL_SECTOR, &header);
+}
+
+/** Reads the journal header, replays the transactions committed
+   before a crash and starts journaling.  Must be called before
+   anything reads the file system. */
+void
+journal_open (void)
+{
+  block_read (fs_device, JOURNAL_SECTOR, &header);
+  if (header.magic != JOURNAL_MAGIC)
+    PANIC ("no journal on file system device, reformat it");
+  replay ();
+  enabled = true;
+}
+
+/** Commits the running transaction and writes everything home, so
+   that the log is empty, then stops journaling. */
+void
+journal_close (void)
+{
+  if (!enabled)
+    return;
+  commit (true);
+  enabled = false;
+}
+
+/** Starts an operation that changes metadata, which is to be
+   committed as a whole, and that dirties at most CREDITS blocks.
+   Commits the running transaction first if it hasn't room for them.
+   Operations nest: only the outermost journal_begin() and
+   journal_end() of a thread count, and the credits of the outermost
+   one must cover the nested ones. */
+void
+journal_begin (size_t credits)
+{
+  struct thread *t = thread_current ();
+
+  if (t->journal_depth++ > 0 || !enabled)
+    return;
+
+  ASSERT (credits <= TXN_MAX - map_sectors);
+  lock_acquire (&journal_lock);
+  while (committing || txn_cnt + txn_credits + credits > TXN_MAX - map_sectors)
+    {
+      if (committing)
+        cond_wait (&commit_done, &journal_lock);
+      else
+        {
+          /* Make room before starting. */
+          lock_release (&journal_lock);
+          t->journal_depth--;
+          commit (false);
+          t->journal_depth++;
+          lock_acquire (&journal_lock);
+        }
+    }
+  txn_credits += credits;
+  t->journal_credits = credits;
+  active_cnt++;
+  lock_release (&journal_lock);
+}
+
+/** Makes sure that the operation under way may still dirty CREDITS
+   more blocks, taking more of the running transaction if need be.
+   Returns false if it hasn't that much room left, in which case the
+   operation must make do without: it can't wait for a commit, which
+   would wait for it in turn. */
+bool
+journal_extend (size_t credits)
+{
+  struct thread *t = thread_current ();
+  bool success = true;
+
+  if (!enabled)
+    return true;
+  ASSERT (t->journal_depth > 0);
+  if (t->journal_credits >= credits)
+    return true;
+
+  lock_acquire (&journal_lock);
+  credits -= t->journal_credits;
+  if (txn_cnt + txn_credits + credits <= TXN_MAX - map_sectors)
+    {
+      txn_credits += credits;
+      t->journal_credits += credits;
+    }
+  else
+    success = false;
+  lock_release (&journal_lock);
+  return success;
+}
+
+/** Ends an operation started with journal_begin().  Its changes are
+   committed along with those of other operations, by the next
+   journal_commit(). */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth > 0 || !enabled)
+    return;
+
+  lock_acquire (&journal_lock);
+  ASSERT (active_cnt > 0);
+  txn_credits -= t->journal_credits;
+  t->journal_credits = 0;
+  if (--active_cnt == 0)
+    cond_broadcast (&handles_done, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/** Commits the running transaction, so that the operations that
+   ended before the call survive a crash.  Call it periodically, and
+   in fsync.  Must not be called inside an operation. */
+void
+journal_commit (void)
+{
+  if (enabled)
+    commit (false);
+  else
+    free_map_flush ();
+}
+
+/** Returns the number of the running transaction, which the changes
+   of the operations under way go in.  Only meaningful inside an
+   operation, which keeps the transaction from committing. */
+uint32_t
+journal_running (void)
+{
+  return next_seq;
+}
+
+/** Returns true if transaction TXN, a number journal_running()
+   returned, has been committed, so that its changes survive a crash.
+   A transaction that took no blocks changed nothing to commit. */
+bool
+journal_committed (uint32_t txn)
+{
+  bool result;
+
+  lock_acquire (&journal_lock);
+  result = !enabled || txn < next_seq || txn_cnt == 0;
+  lock_release (&journal_lock);
+  return result;
+}
+
+/** Called by the buffer cache, with the block's lock held, when a
+   metadata block is dirtied and the journal doesn't hold it yet.
+   Returns true if the running transaction takes BLOCK, in which case
+   the cache must keep it in memory until buffer_cache_unhold(),
+   which it always does inside an operation.  The block counts
+   against the operation's credits.  Blocks dirtied outside any
+   operation, which only formatting does, aren't taken. */
+bool
+journal_dirty (struct buffer_block *block)
+{
+  struct thread *t = thread_current ();
+
+  if (!enabled || t->journal_depth == 0)
+    return false;
+  lock_acquire (&journal_lock);
+  if (t->journal_credits > 0)
+    {
+      t->journal_credits--;
+      txn_credits--;
+    }
+  else if (txn_cnt + txn_credits + map_sectors >= TXN_MAX)
+    PANIC ("journal operation dirtied more blocks than its credits");
+  txn[txn_cnt++] = block;
+  bitmap_mark (logged, block->sector);
+  lock_release (&journal_lock);
+  return true;
+}
+
+/** Returns true if SECTOR was logged since the last checkpoint, or
+   is held by the running transaction, so that the free map must not
+   hand it out again yet. */
+bool
+journal_logged (block_sector_t sector)
+{
+  bool result;
+
+  lock_acquire (&journal_lock);
+  result = bitmap_test (logged, sector);
+  lock_release (&journal_lock);
+  return result;
+}
+
+/** Waits for the operations under way to end, keeping new ones from
+   starting, then writes the running transaction to the log along
+   with the changes to the free map.  Checkpoints afterward if the
+   log is too full for another transaction, or if FULL is true.  If
+   another thread is committing already and FULL is false, just waits
+   for it: whatever the caller did is in that commit. */
+static void
+commit (bool full)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->journal_depth == 0);
+  lock_acquire (&journal_lock);
+  if (committing && !full)
+    {
+      while (committing)
+        cond_wait (&commit_done, &journal_lock);
+      lock_release (&journal_lock);
+      return;
+    }
+  while (committing)
+    cond_wait (&commit_done, &journal_lock);
+  committing = true;
+  while (active_cnt > 0)
+    cond_wait (&handles_done, &journal_lock);
+  lock_release (&journal_lock);
+
+  /* The free map's changes go in the same transaction as the
+     allocations and releases that made them, in the room kept for
+     them. */
+  t->journal_depth++;
+  t->journal_credits = map_sectors;
+  txn_credits = map_sectors;
+  free_map_flush ();
+  txn_credits = 0;
+  t->journal_credits = 0;
+  t->journal_depth--;
+
+  if (txn_cnt > 0)
+    write_transaction ();
+  if (full || header.size - head < TXN_MAX + 2)
+    checkpoint ();
+
+  lock_acquire (&journal_lock);
+  committing = false;
+  cond_broadcast (&commit_done, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/** Writes the running transaction at HEAD in the log, then lets the
+   buffer cache write its blocks home.  No operation may be under
+   way. */
+static void
+write_transaction (void)
+{
+  struct journal_descriptor *d = (struct journal_descriptor *) stage;
+  struct journal_commit *c;
+  const void *buffers[TXN_MAX + 1];
+  size_t i;
+
+  ASSERT (txn_cnt > 0 && txn_cnt <= TXN_MAX);
+  ASSERT (head + txn_cnt + 2 <= header.size);
+
+  memset (d, 0, sizeof *d);
+  d->magic = DESCRIPTOR_MAGIC;
+  d->seq = next_seq;
+  d->cnt = txn_cnt;
+  buffers[0] = d;
+  for (i = 0; i < txn_cnt; i++)
+    {
+      uint8_t *copy = stage + (i + 1) * BLOCK_SECTOR_SIZE;
+
+      d->sectors[i] = txn[i]->sector;
+      buffer_cache_read (txn[i]->sector, copy, 0, BLOCK_SECTOR_SIZE);
+      buffers[i + 1] = copy;
+    }
+  c = (struct journal_commit *) (stage + (txn_cnt + 1) * BLOCK_SECTOR_SIZE);
+  memset (c, 0, sizeof *c);
+  c->magic = COMMIT_MAGIC;
+  c->seq = next_seq;
+  c->cnt = txn_cnt;
+  c->checksum = checksum (stage, txn_cnt + 1);
+
+  /* The commit record goes last, so that the transaction counts
+     only once all of it is on disk. */
+  block_writev (fs_device, header.start + head, txn_cnt + 1, buffers);
+  block_write (fs_device, header.start + head + txn_cnt + 1, c);
+  head += txn_cnt + 2;
+  next_seq++;
+
+  /* The sectors are already in LOGGED, since journal_dirty(). */
+  for (i = 0; i < txn_cnt; i++)
+    buffer_cache_unhold (txn[i]);
+  txn_cnt = 0;
+}
+
+/** Writes every dirty block home, then empties the log.  No block
+   may be held for the journal. */
+static void
+checkpoint (void)
+{
+  buffer_cache_flush_all ();
+
+  lock_acquire (&journal_lock);
+  bitmap_set_all (logged, false);
+  lock_release (&journal_lock);
+  header.seq = next_seq;
+  head = 0;
+  block_write (fs_device, JOURNAL_SECTOR, &header);
+}
+
+/** Copies the blocks of each complete transaction in the log home,
+   oldest first, then empties the log.  The buffer cache must not
+   hold any of the file system yet. */
+static void
+replay (void)
+{
+  struct journal_descriptor *d = (struct journal_descriptor *) stage;
+  struct journal_commit c;
+  uint32_t seq = header.seq;
+  size_t pos = 0;
+  size_t replayed = 0;
+  size_t i;
+
+  while (pos + 2 <= header.size)
+    {
+      block_read (fs_device, header.start + pos, d);
+      if (d->magic != DESCRIPTOR_MAGIC || d->seq != seq
+          || d->cnt == 0 || d->cnt > TXN_MAX
+          || pos + d->cnt + 2 > header.size)
+        break;
+      for (i = 0; i < d->cnt; i++)
+        block_read (fs_device, header.start + pos + 1 + i,
+                    stage + (i + 1) * BLOCK_SECTOR_SIZE);
+      block_read (fs_device, header.start + pos + 1 + d->cnt, &c);
+      if (c.magic != COMMIT_MAGIC || c.seq != seq || c.cnt != d->cnt
+          || c.checksum != checksum (stage, d->cnt + 1))
+        break;
+
+      for (i = 0; i < d->cnt; i++)
+        block_write (fs_device, d->sectors[i],
+                     stage + (i + 1) * BLOCK_SECTOR_SIZE);
+      pos += d->cnt + 2;
+      seq++;
+      replayed++;
+    }
+  if (replayed > 0)
+    printf ("Journal: replayed %zu transactions.\n", replayed);
+
+  /* Whatever is left in the log is older than SEQ now. */
+  header.seq = next_seq = seq;
+  head = 0;
+  block_write (fs_device, JOURNAL_SECTOR, &header);
+}
+
+/** Returns a checksum of the CNT sectors of data at DATA. */
+static uint32_t
+checksum (const void *data, size_t cnt)
+{
+  const uint32_t *words = data;
+  uint32_t sum = 0;
+  size_t i;
+
+  for (i = 0; i < cnt * BLOCK_SECTOR_SIZE / sizeof *words; i++)
+    sum = ((sum << 1) | (sum >> 31)) + words[i];
+  return sum;
+}
@@ -0,0 +1,29 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "devices/block.h"
+
+struct buffer_block;
+
+/** Most blocks one transaction holds in the buffer cache. */
+#define JOURNAL_TXN_MAX 64
+
+void journal_init (void);
+void journal_create (void);
+void journal_open (void);
+void journal_close (void);
+
+void journal_begin (size_t credits);
+bool journal_extend (size_t credits);
+void journal_end (void);
+void journal_commit (void);
+uint32_t journal_running (void);
+bool journal_committed (uint32_t txn);
+
+bool journal_dirty (struct buffer_block *);
+bool journal_logged (block_sector_t);
+
+#endif /**< filesys/journal.h */
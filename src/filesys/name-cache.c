@@ -0,0 +1,155 @@
+#include "filesys/name-cache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/synch.h"
+
+/** Names remembered at once. */
+#define NAME_CACHE_SIZE 256
+
+/** Maps the name of an entry in a directory to the sector of the
+    entry's inode, or to NAME_CACHE_ABSENT if the directory has no
+    entry by that name, so that resolving a path that was resolved
+    recently touches no directory blocks.  The directory code keeps
+    it in step with every dir_add() and dir_remove(). */
+struct name_entry
+{
+    block_sector_t dir;                 /**< Inode sector of the directory. */
+    char name[NAME_MAX + 1];            /**< Null terminated file name. */
+    block_sector_t sector;              /**< Inode sector, or NAME_CACHE_ABSENT. */
+    bool in_use;                        /**< In INDEX or free? */
+    struct hash_elem hash_elem;         /**< Element in INDEX. */
+    struct list_elem lru_elem;          /**< Element in LRU. */
+};
+
+static struct name_entry entries[NAME_CACHE_SIZE];
+static struct hash index;               /**< Entries in use, by DIR and NAME. */
+static struct list lru;                 /**< All entries, most recently used first. */
+static struct lock name_cache_lock;     /**< Protects all of the above. */
+
+static unsigned
+name_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+    const struct name_entry *n = hash_entry(e, struct name_entry, hash_elem);
+    return hash_string(n->name) ^ hash_int(n->dir);
+}
+
+static bool
+name_less (const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED)
+{
+    const struct name_entry *a = hash_entry(a_, struct name_entry, hash_elem);
+    const struct name_entry *b = hash_entry(b_, struct name_entry, hash_elem);
+    return a->dir != b->dir ? a->dir < b->dir : strcmp(a->name, b->name) < 0;
+}
+
+/** Returns the entry for NAME in DIR, moving it to the front of the
+    LRU list, or a null pointer if there is none.  The caller must
+    hold name_cache_lock. */
+static struct name_entry *
+find (block_sector_t dir, const char *name)
+{
+    struct name_entry probe;
+    struct hash_elem *e;
+
+    probe.dir = dir;
+    strlcpy(probe.name, name, sizeof probe.name);
+    e = hash_find(&index, &probe.hash_elem);
+    if (e == NULL) {
+        return NULL;
+    }
+    struct name_entry *n = hash_entry(e, struct name_entry, hash_elem);
+    list_remove(&n->lru_elem);
+    list_push_front(&lru, &n->lru_elem);
+    return n;
+}
+
+/** Initializes the name cache. */
+void
+name_cache_init (void)
+{
+    size_t i;
+
+    if (!hash_init(&index, name_hash, name_less, NULL)) {
+        PANIC("can't allocate name cache");
+    }
+    list_init(&lru);
+    lock_init(&name_cache_lock);
+    for (i = 0; i < NAME_CACHE_SIZE; i++) {
+        entries[i].in_use = false;
+        list_push_back(&lru, &entries[i].lru_elem);
+    }
+}
+
+/** Looks up NAME in the directory whose inode is at DIR.  If the
+    answer is cached, sets *SECTORP to the sector of NAME's inode, or
+    to NAME_CACHE_ABSENT if DIR has no such entry, and returns true.
+    Otherwise returns false. */
+bool
+name_cache_lookup (block_sector_t dir, const char *name, block_sector_t *sectorp)
+{
+    struct name_entry *n;
+
+    if (strlen(name) > NAME_MAX) {
+        return false;
+    }
+    lock_acquire(&name_cache_lock);
+    n = find(dir, name);
+    if (n != NULL) {
+        *sectorp = n->sector;
+    }
+    lock_release(&name_cache_lock);
+    return n != NULL;
+}
+
+/** Records that NAME in the directory whose inode is at DIR refers
+    to the inode at SECTOR, or does not exist if SECTOR is
+    NAME_CACHE_ABSENT, replacing whatever was known before. */
+void
+name_cache_insert (block_sector_t dir, const char *name, block_sector_t sector)
+{
+    struct name_entry *n;
+
+    if (strlen(name) > NAME_MAX) {
+        return;
+    }
+    lock_acquire(&name_cache_lock);
+    n = find(dir, name);
+    if (n == NULL) {
+        // Reuse the least recently used entry
+        n = list_entry(list_back(&lru), struct name_entry, lru_elem);
+        if (n->in_use) {
+            hash_delete(&index, &n->hash_elem);
+        }
+        n->dir = dir;
+        strlcpy(n->name, name, sizeof n->name);
+        n->in_use = true;
+        hash_insert(&index, &n->hash_elem);
+        list_remove(&n->lru_elem);
+        list_push_front(&lru, &n->lru_elem);
+    }
+    n->sector = sector;
+    lock_release(&name_cache_lock);
+}
+
+/** Forgets every name in the directory whose inode is at DIR, which
+    is being removed, so that nothing stale is found if its sector
+    becomes another directory. */
+void
+name_cache_purge_dir (block_sector_t dir)
+{
+    size_t i;
+
+    lock_acquire(&name_cache_lock);
+    for (i = 0; i < NAME_CACHE_SIZE; i++) {
+        struct name_entry *n = &entries[i];
+        if (n->in_use && n->dir == dir) {
+            hash_delete(&index, &n->hash_elem);
+            n->in_use = false;
+            list_remove(&n->lru_elem);
+            list_push_back(&lru, &n->lru_elem);
+        }
+    }
+    lock_release(&name_cache_lock);
+}
@@ -0,0 +1,15 @@
+#ifndef FILESYS_NAME_CACHE_H
+#define FILESYS_NAME_CACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/** Sector recorded for a name known not to exist. */
+#define NAME_CACHE_ABSENT ((block_sector_t) -1)
+
+void name_cache_init (void);
+bool name_cache_lookup (block_sector_t dir, const char *name, block_sector_t *sectorp);
+void name_cache_insert (block_sector_t dir, const char *name, block_sector_t sector);
+void name_cache_purge_dir (block_sector_t dir);
+
+#endif /**< filesys/name-cache.h */
@@ -0,0 +1,28 @@
+#ifndef __LIB_FSSTAT_H
+#define __LIB_FSSTAT_H
+
+/** File system statistics, as returned by the fsstat system call.
+   Every counter but FREE_SECTORS is cumulative since boot, so a
+   benchmark takes a snapshot before and after its workload and
+   subtracts. */
+struct fsstat
+  {
+    /* Buffer cache. */
+    unsigned long long cache_hits;          /**< Lookups that found the sector. */
+    unsigned long long cache_misses;        /**< Lookups that had to load it. */
+    unsigned long long cache_evictions;     /**< Cached sectors replaced. */
+    unsigned long long cache_dirty_evictions; /**< ...that had to be written first. */
+    unsigned long long cache_writebacks;    /**< Dirty sectors written to disk. */
+    unsigned long long cache_read_ahead_hits; /**< Hits on prefetched sectors. */
+
+    /* File system device. */
+    unsigned long long sectors_read;        /**< Sectors read. */
+    unsigned long long sectors_written;     /**< Sectors written. */
+    unsigned long long read_cycles;         /**< CPU cycles spent reading. */
+    unsigned long long write_cycles;        /**< CPU cycles spent writing. */
+
+    /* Free map. */
+    unsigned long long free_sectors;        /**< Sectors free right now. */
+  };
+
+#endif /**< lib/fsstat.h */
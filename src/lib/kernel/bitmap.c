@@ -3,6 +3,7 @@
 #include <limits.h>
 #include <round.h>
 #include <stdio.h>
+#include <string.h>
 #include "threads/malloc.h"
 #ifdef FILESYS
 #include "filesys/file.h"
@@ -21,13 +22,22 @@ typedef unsigned long elem_type;
 /** Number of bits in an element. */
 #define ELEM_BITS (sizeof (elem_type) * CHAR_BIT)
 
+/** Bitmaps with at least this many elements keep a summary. */
+#define SUMMARY_MIN_ELEMS 8
+
 /** From the outside, a bitmap is an array of bits.  From the
    inside, it's an array of elem_type (defined above) that
-   simulates an array of bits. */
+   simulates an array of bits.
+
+   Large bitmaps also keep a summary with one bit per element,
+   set if that element has any bit set to false.  Scans for false
+   bits, which is how palloc and the free map allocate, use it to
+   skip whole runs of full elements at once. */
 struct bitmap
   {
     size_t bit_cnt;     /**< Number of bits. */
     elem_type *bits;    /**< Elements that represent bits. */
+    elem_type *summary; /**< Summary of BITS, or a null pointer. */
   };
 
 /** Returns the index of the element that contains the bit
@@ -60,6 +70,15 @@ byte_cnt (size_t bit_cnt)
   return sizeof (elem_type) * elem_cnt (bit_cnt);
 }
 
+/** Returns the number of elements of summary kept for a bitmap
+   of BIT_CNT bits, 0 if it has none. */
+static inline size_t
+summary_cnt (size_t bit_cnt)
+{
+  size_t cnt = elem_cnt (bit_cnt);
+  return cnt >= SUMMARY_MIN_ELEMS ? elem_cnt (cnt) : 0;
+}
+
 /** Returns a bit mask in which the bits actually used in the last
    element of B's bits are set to 1 and the rest are set to 0. */
 static inline elem_type
@@ -68,6 +87,104 @@ last_mask (const struct bitmap *b)
   int last_bits = b->bit_cnt % ELEM_BITS;
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
+
+/** Returns a mask of the CNT bits starting at bit OFS of an
+   element.  OFS + CNT must not exceed ELEM_BITS. */
+static inline elem_type
+range_mask (size_t ofs, size_t cnt)
+{
+  elem_type mask = cnt < ELEM_BITS ? ((elem_type) 1 << cnt) - 1 : (elem_type) -1;
+  return mask << ofs;
+}
+
+/** Returns the number of bits set in WORD. */
+static inline size_t
+count_bits (elem_type word)
+{
+  size_t cnt;
+  for (cnt = 0; word != 0; cnt++)
+    word &= word - 1;
+  return cnt;
+}
+
+/** Brings the summary bit for element IDX of B up to date after
+   a change to that element. */
+static inline void
+update_summary (struct bitmap *b, size_t idx)
+{
+  elem_type full;
+
+  if (b->summary == NULL)
+    return;
+  full = idx == elem_cnt (b->bit_cnt) - 1 ? last_mask (b) : (elem_type) -1;
+  if (b->bits[idx] == full)
+    b->summary[elem_idx (idx)] &= ~bit_mask (idx);
+  else
+    b->summary[elem_idx (idx)] |= bit_mask (idx);
+}
+
+/** Recomputes B's summary from scratch. */
+static void
+rebuild_summary (struct bitmap *b)
+{
+  size_t i;
+
+  if (b->summary == NULL)
+    return;
+  memset (b->summary, 0, summary_cnt (b->bit_cnt) * sizeof (elem_type));
+  for (i = 0; i < elem_cnt (b->bit_cnt); i++)
+    update_summary (b, i);
+}
+
+/** Returns the index of the first element of B at or after IDX
+   that has a bit set to false, according to B's summary, or the
+   number of elements in B if there is none. */
+static size_t
+next_free_elem (const struct bitmap *b, size_t idx)
+{
+  size_t word_cnt = elem_cnt (b->bit_cnt);
+  size_t i = elem_idx (idx);
+  elem_type word;
+
+  if (idx >= word_cnt)
+    return word_cnt;
+  word = b->summary[i] & ~(bit_mask (idx) - 1);
+  while (word == 0)
+    {
+      if (++i >= summary_cnt (b->bit_cnt))
+        return word_cnt;
+      word = b->summary[i];
+    }
+  idx = i * ELEM_BITS + __builtin_ctzl (word);
+  return idx < word_cnt ? idx : word_cnt;
+}
+
+/** Returns the index of the first bit in B at or after START that
+   is set to VALUE, or the number of bits in B if there is none.
+   Works a whole element at a time. */
+static size_t
+find_bit (const struct bitmap *b, size_t start, bool value)
+{
+  size_t word_cnt = elem_cnt (b->bit_cnt);
+  size_t idx = elem_idx (start);
+  elem_type flip = value ? 0 : (elem_type) -1;
+  elem_type word;
+
+  if (start >= b->bit_cnt)
+    return b->bit_cnt;
+  word = (b->bits[idx] ^ flip) & ~(bit_mask (start) - 1);
+  while (word == 0)
+    {
+      idx++;
+      if (!value && b->summary != NULL)
+        idx = next_free_elem (b, idx);
+      if (idx >= word_cnt)
+        return b->bit_cnt;
+      word = b->bits[idx] ^ flip;
+    }
+  start = idx * ELEM_BITS + __builtin_ctzl (word);
+  return start < b->bit_cnt ? start : b->bit_cnt;
+}
 
 /** Creation and destruction. */
 
@@ -81,10 +198,14 @@ bitmap_create (size_t bit_cnt)
   struct bitmap *b = malloc (sizeof *b);
   if (b != NULL)
     {
+      size_t sum_cnt = summary_cnt (bit_cnt);
+
       b->bit_cnt = bit_cnt;
-      b->bits = malloc (byte_cnt (bit_cnt));
+      b->bits = malloc (byte_cnt (bit_cnt) + sum_cnt * sizeof (elem_type));
       if (b->bits != NULL || bit_cnt == 0)
         {
+          b->summary = sum_cnt > 0 ? b->bits + elem_cnt (bit_cnt) : NULL;
+          rebuild_summary (b);
           bitmap_set_all (b, false);
           return b;
         }
@@ -105,6 +226,8 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 
   b->bit_cnt = bit_cnt;
   b->bits = (elem_type *) (b + 1);
+  b->summary = summary_cnt (bit_cnt) > 0 ? b->bits + elem_cnt (bit_cnt) : NULL;
+  rebuild_summary (b);
   bitmap_set_all (b, false);
   return b;
 }
@@ -114,7 +237,8 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 size_t
 bitmap_buf_size (size_t bit_cnt) 
 {
-  return sizeof (struct bitmap) + byte_cnt (bit_cnt);
+  return (sizeof (struct bitmap) + byte_cnt (bit_cnt)
+          + summary_cnt (bit_cnt) * sizeof (elem_type));
 }
 
 /** Destroys bitmap B, freeing its storage.
@@ -163,6 +287,7 @@ bitmap_mark (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the OR instruction in [IA32-v2b]. */
   asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  update_summary (b, idx);
 }
 
 /** Atomically sets the bit numbered BIT_IDX in B to false. */
@@ -176,6 +301,7 @@ bitmap_reset (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the AND instruction in [IA32-v2a]. */
   asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+  update_summary (b, idx);
 }
 
 /** Atomically toggles the bit numbered IDX in B;
@@ -191,6 +317,7 @@ bitmap_flip (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the XOR instruction in [IA32-v2b]. */
   asm ("xorl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  update_summary (b, idx);
 }
 
 /** Returns the value of the bit numbered IDX in B. */
@@ -217,14 +344,24 @@ bitmap_set_all (struct bitmap *b, bool value)
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  while (cnt > 0)
+    {
+      size_t idx = elem_idx (start);
+      size_t ofs = start % ELEM_BITS;
+      size_t n = cnt < ELEM_BITS - ofs ? cnt : ELEM_BITS - ofs;
+
+      if (value)
+        b->bits[idx] |= range_mask (ofs, n);
+      else
+        b->bits[idx] &= ~range_mask (ofs, n);
+      update_summary (b, idx);
+      start += n;
+      cnt -= n;
+    }
 }
 
 /** Returns the number of bits in B between START and START + CNT,
@@ -232,17 +369,22 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i, value_cnt;
+  size_t total = cnt, set_cnt = 0;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
-  return value_cnt;
+  while (cnt > 0)
+    {
+      size_t ofs = start % ELEM_BITS;
+      size_t n = cnt < ELEM_BITS - ofs ? cnt : ELEM_BITS - ofs;
+
+      set_cnt += count_bits (b->bits[elem_idx (start)] & range_mask (ofs, n));
+      start += n;
+      cnt -= n;
+    }
+  return value ? set_cnt : total - set_cnt;
 }
 
 /** Returns true if any bits in B between START and START + CNT,
@@ -250,16 +392,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return cnt > 0 && find_bit (b, start, value) < start + cnt;
 }
 
 /** Returns true if any bits in B between START and START + CNT,
@@ -291,22 +428,35 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 /** Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+
+   Rather than test every possible start, this jumps from each
+   bit set to VALUE to the end of its run, a whole element at a
+   time, so it takes time proportional to the number of runs and
+   elements it passes over.  Full elements are skipped through
+   the summary when looking for false bits. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
-  if (cnt <= b->bit_cnt) 
+  if (cnt > b->bit_cnt)
+    return BITMAP_ERROR;
+  if (cnt == 0)
+    return start;
+  for (;;)
     {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t end;
+
+      start = find_bit (b, start, value);
+      if (start > b->bit_cnt - cnt)
+        return BITMAP_ERROR;
+      end = find_bit (b, start, !value);
+      if (end - start >= cnt)
+        return start;
+      start = end;
     }
-  return BITMAP_ERROR;
 }
 
 /** Finds the first group of CNT consecutive bits in B at or after
@@ -314,8 +464,8 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
    and returns the index of the first bit in the group.
    If there is no such group, returns BITMAP_ERROR.
    If CNT is zero, returns 0.
-   Bits are set atomically, but testing bits is not atomic with
-   setting them. */
+   Neither testing nor setting the bits is atomic, so callers
+   that share B must serialize. */
 size_t
 bitmap_scan_and_flip (struct bitmap *b, size_t start, size_t cnt, bool value)
 {
@@ -346,6 +496,7 @@ bitmap_read (struct bitmap *b, struct file *file)
       off_t size = byte_cnt (b->bit_cnt);
       success = file_read_at (file, b->bits, size, 0) == size;
       b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+      rebuild_summary (b);
     }
   return success;
 }
@@ -358,6 +509,24 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/** Writes the SIZE bytes at offset OFS of B's file image, as
+   written by bitmap_write(), to the same place in FILE, so that
+   a caller that knows which part of B changed need not rewrite
+   all of it.  The range is clipped to the image.  Returns true if
+   successful, false otherwise. */
+bool
+bitmap_write_part (const struct bitmap *b, struct file *file,
+                   size_t ofs, size_t size)
+{
+  size_t file_size = byte_cnt (b->bit_cnt);
+  if (ofs >= file_size)
+    return true;
+  if (size > file_size - ofs)
+    size = file_size - ofs;
+  return file_write_at (file, (const uint8_t *) b->bits + ofs, size, ofs)
+         == (off_t) size;
+}
 #endif /**< FILESYS */
 
 /** Debugging. */
@@ -28,7 +28,13 @@ enum
     SYS_MKDIR,                  /**< Create a directory. */
     SYS_READDIR,                /**< Reads a directory entry. */
     SYS_ISDIR,                  /**< Tests if a fd represents a directory. */
-    SYS_INUMBER                 /**< Returns the inode number for a fd. */
+    SYS_INUMBER,                /**< Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_FSSTAT,                 /**< Snapshots file system statistics. */
+    SYS_FSYNC,                  /**< Writes a file's data and metadata to disk. */
+    SYS_FDATASYNC,              /**< Writes a file's data to disk. */
+    SYS_FALLOCATE               /**< Preallocates space for a file. */
   };
 
 #endif /**< lib/syscall-nr.h */
@@ -182,3 +182,27 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+bool
+fsstat (struct fsstat *stats)
+{
+  return syscall1 (SYS_FSSTAT, stats);
+}
+
+bool
+fsync (int fd)
+{
+  return syscall1 (SYS_FSYNC, fd);
+}
+
+bool
+fdatasync (int fd)
+{
+  return syscall1 (SYS_FDATASYNC, fd);
+}
+
+bool
+fallocate (int fd, unsigned offset, unsigned length)
+{
+  return syscall3 (SYS_FALLOCATE, fd, offset, length);
+}
@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <fsstat.h>
 
 /** Process identifier. */
 typedef int pid_t;
@@ -45,4 +46,10 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/** Extensions. */
+bool fsstat (struct fsstat *);
+bool fsync (int fd);
+bool fdatasync (int fd);
+bool fallocate (int fd, unsigned offset, unsigned length);
+
 #endif /**< lib/user/syscall.h */
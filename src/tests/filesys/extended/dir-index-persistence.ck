@@ -0,0 +1,8 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($fs);
+$fs->{"dir"}{"file$_"} = [''] foreach 0...199;
+check_archive ($fs);
+pass;
@@ -0,0 +1,98 @@
+/** Creates enough files in one directory for it to be indexed,
+   then looks each one up, removes every other one, checks that
+   only those are gone, and adds them back.  dir-index-persistence
+   checks that all of them survive a reboot. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Well past the 64 entries at which a directory gets an index, so
+   that the index is rebuilt bigger along the way too. */
+#define FILE_CNT 200
+
+static void
+file_name (char *name, size_t size, int i)
+{
+  snprintf (name, size, "dir/file%d", i);
+}
+
+/* Checks that the files from FIRST on, every STEP-th one, can be
+   opened if EXISTS is true and can't be otherwise. */
+static void
+check_files (int first, int step, bool exists)
+{
+  char name[32];
+  int i, fd;
+
+  quiet = true;
+  for (i = first; i < FILE_CNT; i += step)
+    {
+      file_name (name, sizeof name, i);
+      fd = open (name);
+      if (exists)
+        {
+          CHECK (fd > 1, "open \"%s\"", name);
+          close (fd);
+        }
+      else
+        CHECK (fd == -1, "open \"%s\" (must return -1)", name);
+    }
+  quiet = false;
+}
+
+/* Creates the files from FIRST on, every STEP-th one. */
+static void
+create_files (int first, int step)
+{
+  char name[32];
+  int i;
+
+  quiet = true;
+  for (i = first; i < FILE_CNT; i += step)
+    {
+      file_name (name, sizeof name, i);
+      CHECK (create (name, 0), "create \"%s\"", name);
+    }
+  quiet = false;
+}
+
+void
+test_main (void)
+{
+  char name[32];
+  int fd, cnt, i;
+
+  CHECK (mkdir ("dir"), "mkdir \"dir\"");
+
+  msg ("create %d files in \"dir\"", FILE_CNT);
+  create_files (0, 1);
+  msg ("look up every file");
+  check_files (0, 1, true);
+
+  msg ("remove every other file");
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i += 2)
+    {
+      file_name (name, sizeof name, i);
+      CHECK (remove (name), "remove \"%s\"", name);
+    }
+  quiet = false;
+  msg ("check that the removed files are gone");
+  check_files (0, 2, false);
+  msg ("check that the others are still there");
+  check_files (1, 2, true);
+
+  msg ("create the removed files again");
+  create_files (0, 2);
+  msg ("look up every file");
+  check_files (0, 1, true);
+
+  CHECK ((fd = open ("dir")) > 1, "open \"dir\"");
+  for (cnt = 0; readdir (fd, name); cnt++)
+    continue;
+  CHECK (cnt == FILE_CNT, "readdir \"dir\" finds %d files", FILE_CNT);
+  msg ("close \"dir\"");
+  close (fd);
+}
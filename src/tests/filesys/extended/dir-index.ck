@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-index) begin
+(dir-index) mkdir "dir"
+(dir-index) create 200 files in "dir"
+(dir-index) look up every file
+(dir-index) remove every other file
+(dir-index) check that the removed files are gone
+(dir-index) check that the others are still there
+(dir-index) create the removed files again
+(dir-index) look up every file
+(dir-index) open "dir"
+(dir-index) readdir "dir" finds 200 files
+(dir-index) close "dir"
+(dir-index) end
+EOF
+pass;
@@ -0,0 +1,18 @@
+/** Tests that fallocate() refuses to preallocate space for a
+   directory. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  int fd;
+
+  CHECK (mkdir ("a"), "mkdir \"a\"");
+  CHECK ((fd = open ("a")) > 1, "open \"a\"");
+  CHECK (!fallocate (fd, 0, 512), "fallocate \"a\" (must return false)");
+  msg ("close \"a\"");
+  close (fd);
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fallocate-dir) begin
+(fallocate-dir) mkdir "a"
+(fallocate-dir) open "a"
+(fallocate-dir) fallocate "a" (must return false)
+(fallocate-dir) close "a"
+(fallocate-dir) end
+EOF
+pass;
@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_archive ({"testfile" => [("\0" x 1000) . "abc" . ("\0" x 7097)]});
+pass;
@@ -0,0 +1,42 @@
+/** Tests that fallocate() extends a file with space that reads
+   back as zeros, that writing part of a preallocated block zeros
+   the rest of it, and that preallocating within a file leaves its
+   length alone. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[8100];
+
+void
+test_main (void)
+{
+  const char *file_name = "testfile";
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (fallocate (fd, 0, 5000), "fallocate 5000 bytes of \"%s\"",
+         file_name);
+  CHECK (filesize (fd) == 5000, "filesize \"%s\" is 5000", file_name);
+  seek (fd, 0);
+  check_file_handle (fd, file_name, buf, 5000);
+
+  memcpy (buf + 1000, "abc", 3);
+  msg ("seek \"%s\"", file_name);
+  seek (fd, 1000);
+  CHECK (write (fd, "abc", 3) == 3, "write \"%s\"", file_name);
+  seek (fd, 0);
+  check_file_handle (fd, file_name, buf, 5000);
+
+  CHECK (fallocate (fd, 8000, 100), "fallocate past end of \"%s\"",
+         file_name);
+  CHECK (filesize (fd) == 8100, "filesize \"%s\" is 8100", file_name);
+  CHECK (fallocate (fd, 0, 512), "fallocate within \"%s\"", file_name);
+  CHECK (filesize (fd) == 8100, "filesize \"%s\" is 8100", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
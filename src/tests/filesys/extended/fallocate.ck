@@ -0,0 +1,25 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fallocate) begin
+(fallocate) create "testfile"
+(fallocate) open "testfile"
+(fallocate) fallocate 5000 bytes of "testfile"
+(fallocate) filesize "testfile" is 5000
+(fallocate) verified contents of "testfile"
+(fallocate) seek "testfile"
+(fallocate) write "testfile"
+(fallocate) verified contents of "testfile"
+(fallocate) fallocate past end of "testfile"
+(fallocate) filesize "testfile" is 8100
+(fallocate) fallocate within "testfile"
+(fallocate) filesize "testfile" is 8100
+(fallocate) close "testfile"
+(fallocate) open "testfile" for verification
+(fallocate) verified contents of "testfile"
+(fallocate) close "testfile"
+(fallocate) end
+EOF
+pass;
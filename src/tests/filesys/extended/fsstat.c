@@ -0,0 +1,31 @@
+/** Tests that fsstat() counts the buffer cache lookups made while
+   reading a file back. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[4096];
+
+void
+test_main (void)
+{
+  const char *file_name = "testfile";
+  struct fsstat before, after;
+  int fd;
+
+  memset (buf, 'f', sizeof buf);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, sizeof buf) == (int) sizeof buf, "write \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  CHECK (fsstat (&before), "fsstat");
+  check_file (file_name, buf, sizeof buf);
+  CHECK (fsstat (&after), "fsstat");
+  CHECK (after.cache_hits + after.cache_misses
+         >= before.cache_hits + before.cache_misses + sizeof buf / 512,
+         "every sector read was looked up in the cache");
+}
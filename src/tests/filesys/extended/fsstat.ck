@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fsstat) begin
+(fsstat) create "testfile"
+(fsstat) open "testfile"
+(fsstat) write "testfile"
+(fsstat) close "testfile"
+(fsstat) fsstat
+(fsstat) open "testfile" for verification
+(fsstat) verified contents of "testfile"
+(fsstat) close "testfile"
+(fsstat) fsstat
+(fsstat) every sector read was looked up in the cache
+(fsstat) end
+EOF
+pass;
@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_archive ({"testfile" => [("z" x 512) . ("y" x 3584) . ("z" x 512)]});
+pass;
@@ -0,0 +1,58 @@
+/** Tests that fsync() and fdatasync() write a file's dirty data
+   to disk before returning, along with its new length when a
+   write extended it, and that they reject a file descriptor that
+   isn't open.  fsync-persistence checks the length and contents
+   after a reboot. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[4608];
+
+void
+test_main (void)
+{
+  const char *file_name = "testfile";
+  struct fsstat before, after;
+  int fd;
+
+  memset (buf, 'y', 4096);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, 4096) == 4096, "write \"%s\"", file_name);
+  CHECK (fsstat (&before), "fsstat");
+  CHECK (fsync (fd), "fsync \"%s\"", file_name);
+  CHECK (fsstat (&after), "fsstat");
+  CHECK (after.sectors_written >= before.sectors_written + 4096 / 512,
+         "fsync wrote the data");
+  CHECK (filesize (fd) == 4096, "fsync kept the length");
+
+  /* Extend the file again, this time for fdatasync() to commit. */
+  memset (buf + 4096, 'z', 512);
+  CHECK (write (fd, buf + 4096, 512) == 512, "write \"%s\"", file_name);
+  CHECK (fsstat (&before), "fsstat");
+  CHECK (fdatasync (fd), "fdatasync \"%s\"", file_name);
+  CHECK (fsstat (&after), "fsstat");
+  CHECK (after.sectors_written > before.sectors_written,
+         "fdatasync wrote the data");
+  CHECK (filesize (fd) == (int) sizeof buf, "fdatasync kept the length");
+
+  /* Then overwrite the start, which changes no metadata. */
+  memset (buf, 'z', 512);
+  msg ("seek \"%s\"", file_name);
+  seek (fd, 0);
+  CHECK (write (fd, buf, 512) == 512, "write \"%s\"", file_name);
+  CHECK (fsstat (&before), "fsstat");
+  CHECK (fdatasync (fd), "fdatasync \"%s\"", file_name);
+  CHECK (fsstat (&after), "fsstat");
+  CHECK (after.sectors_written > before.sectors_written,
+         "fdatasync wrote the data");
+
+  CHECK (!fsync (fd + 1), "fsync unopened fd (must return false)");
+  CHECK (!fdatasync (fd + 1), "fdatasync unopened fd (must return false)");
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
@@ -0,0 +1,35 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fsync) begin
+(fsync) create "testfile"
+(fsync) open "testfile"
+(fsync) write "testfile"
+(fsync) fsstat
+(fsync) fsync "testfile"
+(fsync) fsstat
+(fsync) fsync wrote the data
+(fsync) fsync kept the length
+(fsync) write "testfile"
+(fsync) fsstat
+(fsync) fdatasync "testfile"
+(fsync) fsstat
+(fsync) fdatasync wrote the data
+(fsync) fdatasync kept the length
+(fsync) seek "testfile"
+(fsync) write "testfile"
+(fsync) fsstat
+(fsync) fdatasync "testfile"
+(fsync) fsstat
+(fsync) fdatasync wrote the data
+(fsync) fsync unopened fd (must return false)
+(fsync) fdatasync unopened fd (must return false)
+(fsync) close "testfile"
+(fsync) open "testfile" for verification
+(fsync) verified contents of "testfile"
+(fsync) close "testfile"
+(fsync) end
+EOF
+pass;
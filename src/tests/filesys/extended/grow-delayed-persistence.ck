@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_archive ({"testfile" => [join ('', map (chr ($_ % 251), 0...7999))]});
+pass;
@@ -0,0 +1,43 @@
+/** Writes a file in small appends, whose blocks get sectors only
+   when the file is closed, then reopens it and checks its contents,
+   twice.  grow-delayed-persistence checks them after a reboot. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[8000];
+
+/* Opens FILE_NAME and appends bytes OFS...OFS + SIZE - 1 of BUF to
+   it, 100 at a time, then closes it. */
+static void
+append (const char *file_name, size_t ofs, size_t size)
+{
+  size_t i;
+  int fd;
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  seek (fd, ofs);
+  msg ("write %zu bytes to \"%s\" in 100-byte pieces", size, file_name);
+  for (i = 0; i < size; i += 100)
+    if (write (fd, buf + ofs + i, 100) != 100)
+      fail ("write of 100 bytes at offset %zu in \"%s\" failed",
+            ofs + i, file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
+
+void
+test_main (void)
+{
+  const char *file_name = "testfile";
+  size_t i;
+
+  for (i = 0; i < sizeof buf; i++)
+    buf[i] = i % 251;
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  append (file_name, 0, 5000);
+  check_file (file_name, buf, 5000);
+  append (file_name, 5000, 3000);
+  check_file (file_name, buf, sizeof buf);
+}
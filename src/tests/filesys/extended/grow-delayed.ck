@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-delayed) begin
+(grow-delayed) create "testfile"
+(grow-delayed) open "testfile"
+(grow-delayed) write 5000 bytes to "testfile" in 100-byte pieces
+(grow-delayed) close "testfile"
+(grow-delayed) open "testfile" for verification
+(grow-delayed) verified contents of "testfile"
+(grow-delayed) close "testfile"
+(grow-delayed) open "testfile"
+(grow-delayed) write 3000 bytes to "testfile" in 100-byte pieces
+(grow-delayed) close "testfile"
+(grow-delayed) open "testfile" for verification
+(grow-delayed) verified contents of "testfile"
+(grow-delayed) close "testfile"
+(grow-delayed) end
+EOF
+pass;
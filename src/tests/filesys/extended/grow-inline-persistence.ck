@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_archive ({"testfile" => [("a" x 450) . ("b" x 100) . ("c" x 1000)]});
+pass;
@@ -0,0 +1,37 @@
+/** Grows a file whose data starts out inline in its inode past the
+   500 bytes that fit there, so that it moves out to a data block,
+   checking its contents before and after.  grow-inline-persistence
+   checks them after a reboot. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[1550];
+
+/* Appends SIZE bytes of C to the file open as FD, which has OFS
+   bytes, and checks the whole file. */
+static void
+append (const char *file_name, int fd, size_t ofs, size_t size, char c)
+{
+  memset (buf + ofs, c, size);
+  CHECK (write (fd, buf + ofs, size) == (int) size,
+         "write %zu bytes to \"%s\"", size, file_name);
+  check_file (file_name, buf, ofs + size);
+}
+
+void
+test_main (void)
+{
+  const char *file_name = "testfile";
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  append (file_name, fd, 0, 450, 'a');
+  append (file_name, fd, 450, 100, 'b');
+  append (file_name, fd, 550, 1000, 'c');
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
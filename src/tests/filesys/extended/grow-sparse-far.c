@@ -0,0 +1,36 @@
+/** Tests that seeking far past the end of a file and writing a
+   single byte leaves the region in between as a hole: it reads
+   back as zeros, and only the byte's data block and the index
+   blocks needed to reach it take space on disk. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Long enough that the last byte is reached through the double
+   indirect block and one indirect block under it. */
+static char buf[150001];
+
+void
+test_main (void)
+{
+  const char *file_name = "testfile";
+  struct fsstat before, after;
+  char x = 'x';
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (fsstat (&before), "fsstat");
+  msg ("seek \"%s\"", file_name);
+  seek (fd, sizeof buf - 1);
+  CHECK (write (fd, &x, 1) > 0, "write \"%s\"", file_name);
+  CHECK (fsync (fd), "fsync \"%s\"", file_name);
+  CHECK (fsstat (&after), "fsstat");
+  CHECK (before.free_sectors - after.free_sectors == 3,
+         "one data block and two index blocks allocated");
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  buf[sizeof buf - 1] = 'x';
+  check_file (file_name, buf, sizeof buf);
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-sparse-far) begin
+(grow-sparse-far) create "testfile"
+(grow-sparse-far) open "testfile"
+(grow-sparse-far) fsstat
+(grow-sparse-far) seek "testfile"
+(grow-sparse-far) write "testfile"
+(grow-sparse-far) fsync "testfile"
+(grow-sparse-far) fsstat
+(grow-sparse-far) one data block and two index blocks allocated
+(grow-sparse-far) close "testfile"
+(grow-sparse-far) open "testfile" for verification
+(grow-sparse-far) verified contents of "testfile"
+(grow-sparse-far) close "testfile"
+(grow-sparse-far) end
+EOF
+pass;
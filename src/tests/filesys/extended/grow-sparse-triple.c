@@ -0,0 +1,55 @@
+/** Tests that writing a single byte one block past the range of
+   the double indirect block, about 8 MB into a file, reaches it
+   through the triple indirect block: only the byte's data block and
+   the three index blocks on the way to it take space on disk, and
+   the byte reads back, with zeros before it.  The file is removed
+   at the end, since it is far too long for the tar archive that
+   grow-sparse-triple-persistence checks. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* First block mapped through the triple indirect block: past the
+   122 direct blocks, the 128 of the indirect block and the 128 * 128
+   of the double indirect block. */
+#define TRIPLE_FIRST (122 + 128 + 128 * 128)
+#define OFFSET (TRIPLE_FIRST * 512 + 100)
+
+void
+test_main (void)
+{
+  const char *file_name = "testfile";
+  struct fsstat before, after;
+  char block[512], zeros[512];
+  char x = 'x';
+  int fd;
+
+  memset (zeros, 0, sizeof zeros);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (fsstat (&before), "fsstat");
+  msg ("seek \"%s\" to %d", file_name, OFFSET);
+  seek (fd, OFFSET);
+  CHECK (write (fd, &x, 1) > 0, "write \"%s\"", file_name);
+  CHECK (fsync (fd), "fsync \"%s\"", file_name);
+  CHECK (fsstat (&after), "fsstat");
+  CHECK (before.free_sectors - after.free_sectors == 4,
+         "one data block and three index blocks allocated");
+  CHECK (filesize (fd) == OFFSET + 1, "filesize \"%s\"", file_name);
+
+  msg ("read back the block before the byte");
+  seek (fd, OFFSET - 100 - sizeof block);
+  CHECK (read (fd, block, sizeof block) == (int) sizeof block,
+         "read \"%s\"", file_name);
+  compare_bytes (block, zeros, sizeof block, OFFSET - 100 - sizeof block,
+                 file_name);
+  msg ("read back the byte and the zeros before it");
+  CHECK (read (fd, block, 101) == 101, "read \"%s\"", file_name);
+  compare_bytes (block, zeros, 100, OFFSET - 100, file_name);
+  CHECK (block[100] == 'x', "byte at offset %d is 'x'", OFFSET);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  CHECK (remove (file_name), "remove \"%s\"", file_name);
+}
@@ -0,0 +1,25 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-sparse-triple) begin
+(grow-sparse-triple) create "testfile"
+(grow-sparse-triple) open "testfile"
+(grow-sparse-triple) fsstat
+(grow-sparse-triple) seek "testfile" to 8516708
+(grow-sparse-triple) write "testfile"
+(grow-sparse-triple) fsync "testfile"
+(grow-sparse-triple) fsstat
+(grow-sparse-triple) one data block and three index blocks allocated
+(grow-sparse-triple) filesize "testfile"
+(grow-sparse-triple) read back the block before the byte
+(grow-sparse-triple) read "testfile"
+(grow-sparse-triple) read back the byte and the zeros before it
+(grow-sparse-triple) read "testfile"
+(grow-sparse-triple) byte at offset 8516708 is 'x'
+(grow-sparse-triple) close "testfile"
+(grow-sparse-triple) remove "testfile"
+(grow-sparse-triple) end
+EOF
+pass;
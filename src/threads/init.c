@@ -36,6 +36,8 @@
 #include "devices/ide.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/cache.h"
+#include "filesys/cache-policy.h"
 #endif
 
 /** Page directory with kernel mappings only. */
@@ -259,6 +261,14 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-cache"))
+        cache_size = atoi (value);
+      else if (!strcmp (name, "-cache-policy"))
+        cache_policy_name = value;
+      else if (!strcmp (name, "-cache-flush"))
+        cache_flush_interval = atoi (value);
+      else if (!strcmp (name, "-cache-age"))
+        cache_dirty_age = atoi (value);
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -387,6 +397,11 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -cache=N           Cache N disk sectors (default: 1/64 of RAM).\n"
+          "  -cache-policy=NAME Use NAME (2q or clock) for cache replacement.\n"
+          "  -cache-flush=MS    Write back aged dirty cache blocks every MS ms\n"
+          "                     (0 disables write-behind).\n"
+          "  -cache-age=MS      Write back cache blocks dirty for at least MS ms.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
@@ -36,6 +36,10 @@ struct pool
 /** Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
+/** Called when the user pool runs out of pages, to reclaim some
+   from a cache kept there, or null. */
+static palloc_shrink_func *user_shrinker;
+
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
@@ -61,6 +65,15 @@ palloc_init (size_t user_page_limit)
              user_pages, "user pool");
 }
 
+/** Registers SHRINKER to be called when an allocation from the
+   user pool fails.  SHRINKER must not allocate user pages
+   itself. */
+void
+palloc_set_user_shrinker (palloc_shrink_func *shrinker)
+{
+  user_shrinker = shrinker;
+}
+
 /** Obtains and returns a group of PAGE_CNT contiguous free pages.
    If PAL_USER is set, the pages are obtained from the user pool,
    otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
@@ -81,6 +94,16 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
   lock_release (&pool->lock);
 
+  /* Under memory pressure, ask the cache living in the user pool
+     to give some pages back, then try once more. */
+  if (page_idx == BITMAP_ERROR && pool == &user_pool && user_shrinker != NULL
+      && user_shrinker (page_cnt) > 0)
+    {
+      lock_acquire (&pool->lock);
+      page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+      lock_release (&pool->lock);
+    }
+
   if (page_idx != BITMAP_ERROR)
     pages = pool->base + PGSIZE * page_idx;
   else
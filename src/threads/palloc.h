@@ -11,7 +11,12 @@ enum palloc_flags
     PAL_USER = 004              /**< User page. */
   };
 
+/** A function that gives back up to PAGE_CNT user pool pages
+   held by some cache and returns how many it freed. */
+typedef size_t palloc_shrink_func (size_t page_cnt);
+
 void palloc_init (size_t user_page_limit);
+void palloc_set_user_shrinker (palloc_shrink_func *);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
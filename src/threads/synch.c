@@ -336,3 +336,92 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   while (!list_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/** Initializes RW.  A readers-writer lock may be held by any
+   number of readers at once or by a single writer.  Writers are
+   preferred: once one is waiting, new readers wait too, so a
+   steady stream of readers cannot starve it.  Neither kind of
+   holder may acquire RW again while holding it. */
+void
+rwlock_init (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_init (&rw->lock);
+  cond_init (&rw->can_read);
+  cond_init (&rw->can_write);
+  rw->readers = 0;
+  rw->waiting_writers = 0;
+  rw->writer = NULL;
+}
+
+/** Acquires RW for reading, sleeping until no writer holds it or
+   is waiting for it. */
+void
+rwlock_acquire_read (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+  ASSERT (rw->writer != thread_current ());
+
+  lock_acquire (&rw->lock);
+  while (rw->writer != NULL || rw->waiting_writers > 0)
+    cond_wait (&rw->can_read, &rw->lock);
+  rw->readers++;
+  lock_release (&rw->lock);
+}
+
+/** Releases RW, which the current thread holds for reading. */
+void
+rwlock_release_read (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_acquire (&rw->lock);
+  ASSERT (rw->readers > 0);
+  if (--rw->readers == 0)
+    cond_signal (&rw->can_write, &rw->lock);
+  lock_release (&rw->lock);
+}
+
+/** Acquires RW for writing, sleeping until nobody else holds it. */
+void
+rwlock_acquire_write (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+  ASSERT (rw->writer != thread_current ());
+
+  lock_acquire (&rw->lock);
+  rw->waiting_writers++;
+  while (rw->writer != NULL || rw->readers > 0)
+    cond_wait (&rw->can_write, &rw->lock);
+  rw->waiting_writers--;
+  rw->writer = thread_current ();
+  lock_release (&rw->lock);
+}
+
+/** Releases RW, which the current thread holds for writing, handing
+   it to the next waiting writer if there is one, otherwise to all
+   the waiting readers. */
+void
+rwlock_release_write (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+  ASSERT (rwlock_held_for_write (rw));
+
+  lock_acquire (&rw->lock);
+  rw->writer = NULL;
+  if (rw->waiting_writers > 0)
+    cond_signal (&rw->can_write, &rw->lock);
+  else
+    cond_broadcast (&rw->can_read, &rw->lock);
+  lock_release (&rw->lock);
+}
+
+/** Returns true if the current thread holds RW for writing. */
+bool
+rwlock_held_for_write (const struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  return rw->writer == thread_current ();
+}
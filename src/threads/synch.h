@@ -41,6 +41,24 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/** Readers-writer lock. */
+struct rwlock
+  {
+    struct lock lock;           /**< Protects the members below. */
+    struct condition can_read;  /**< Signaled when readers may enter. */
+    struct condition can_write; /**< Signaled when a writer may enter. */
+    unsigned readers;           /**< Threads holding it for reading. */
+    unsigned waiting_writers;   /**< Threads waiting to write. */
+    struct thread *writer;      /**< Thread holding it for writing. */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_held_for_write (const struct rwlock *);
+
 /** Optimization barrier.
 
    The compiler will not reorder operations across an
@@ -118,6 +118,8 @@ struct thread
 
     // New: project 4 directory
     struct dir *cwd;
+    int journal_depth;                 // Nesting of journal_begin() (filesys/journal.c)
+    size_t journal_credits;            // Blocks its operation may still dirty (filesys/journal.c)
 
     /* Owned by thread.c. */
     unsigned magic;                     /**< Detects stack overflow. */
@@ -167,6 +167,15 @@ pagedir_is_dirty (uint32_t *pd, const void *vpage)
   return pte != NULL && (*pte & PTE_D) != 0;
 }
 
+/** Returns true if PD maps virtual page VPAGE read/write.
+   Returns false if PD contains no PTE for VPAGE. */
+bool
+pagedir_is_writable (uint32_t *pd, const void *vpage) 
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  return pte != NULL && (*pte & PTE_P) != 0 && (*pte & PTE_W) != 0;
+}
+
 /** Set the dirty bit to DIRTY in the PTE for virtual page VPAGE
    in PD. */
 void
@@ -1,11 +1,14 @@
 #include "userprog/syscall.h"
 #include "devices/shutdown.h"
+#include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "userprog/pagedir.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
 
 // used to toggle print statements
@@ -16,11 +19,11 @@
 
 static void syscall_handler(struct intr_frame *);
 bool valid_addr(void * vaddr);
+bool valid_writable(void *vaddr);
 bool valid_str(char *str);
 
 void syscall_init(void) {
   intr_register_int(0x30, 3, INTR_ON, syscall_handler, "syscall");
-  lock_init(&file_lock);
   lock_init(&process_lock);
 }
 
@@ -49,6 +52,12 @@ bool valid_addr(void *vaddr) {
     return true;
 }
 
+/* Like valid_addr(), but also requires the page to be writable, for
+   buffers the kernel copies results into */
+bool valid_writable(void *vaddr) {
+    return valid_addr(vaddr) && pagedir_is_writable(thread_current()->pagedir, vaddr);
+}
+
 bool valid_str(char *str){
     // Check if the str is in the user address space
     if (!is_user_vaddr(str)) {
@@ -253,6 +262,35 @@ static void syscall_handler(struct intr_frame *f UNUSED) {
       f->eax = inumber(*(stack_p + 1));
       break;
 
+    // Case 19: Snapshot file system statistics
+    case SYS_FSSTAT:
+      debug_printf("(syscall) syscall_funct is [SYS_FSSTAT]\n");
+      if (!valid_addr(stack_p + 1) || !valid_writable((void *) *(stack_p + 1))
+          || !valid_writable((char *) *(stack_p + 1) + sizeof (struct fsstat) - 1)) { exit(-1); }
+      f->eax = fsstat((struct fsstat *) *(stack_p + 1));
+      break;
+
+    // Case 20: Write a file's data and metadata to disk
+    case SYS_FSYNC:
+      debug_printf("(syscall) syscall_funct is [SYS_FSYNC]\n");
+      if (!valid_addr(stack_p + 1)) { exit(-1); }
+      f->eax = fsync(*(stack_p + 1));
+      break;
+
+    // Case 21: Write a file's data to disk
+    case SYS_FDATASYNC:
+      debug_printf("(syscall) syscall_funct is [SYS_FDATASYNC]\n");
+      if (!valid_addr(stack_p + 1)) { exit(-1); }
+      f->eax = fdatasync(*(stack_p + 1));
+      break;
+
+    // Case 22: Preallocate space for a file
+    case SYS_FALLOCATE:
+      debug_printf("(syscall) syscall_funct is [SYS_FALLOCATE]\n");
+      if (!valid_addr(stack_p + 1) || !valid_addr(stack_p + 2) || !valid_addr(stack_p + 3)) { exit(-1); }
+      f->eax = fallocate(*(stack_p + 1), *(stack_p + 2), *(stack_p + 3));
+      break;
+
     //~~~~~ Project 2 System Calls ~~~~~
     // Default to exiting the process 
     default: 
@@ -329,11 +367,7 @@ bool create(const char *file, unsigned initial_size) {
     return -1;
   }
 
-  // using locks to prevent race conditions
-  debug_printf("create(): attempting to acquire file lock\n");
-  lock_acquire(&file_lock);
   int result = filesys_create(file, initial_size, 0); // return 0 for is_dir
-  lock_release(&file_lock);
   debug_printf("create(): result = %d!\n", result); 
   
   return result;
@@ -346,10 +380,8 @@ bool remove(const char *file) {
     return -1;
   }
 
-  lock_acquire(&file_lock);
   bool result = filesys_remove(file);
   debug_printf("remove(): result removing[%d]! \n", result);
-  lock_release(&file_lock);
   return result;
 }
 
@@ -375,9 +407,7 @@ struct file_inst *locate_file (int fd) {
 int open(const char *file) {
   // Opens the file, returning non-negative integer, -1, or the fd
   debug_printf("(open) Opening file [%s]\n", file);
-  lock_acquire(&file_lock);
   struct file *file_p = filesys_open(file);
-  lock_release(&file_lock);
   // Return if we failed to open the file
   if (file_p == NULL) {
     debug_printf("(open) failed to open file\n");
@@ -422,9 +452,7 @@ int read(int fd, void *buffer, unsigned size) {
   if (fd_e == NULL) exit(-1);
 
   // read file
-  lock_acquire(&file_lock);
   int result = file_read(fd_e->file_p, buffer, size);
-  lock_release(&file_lock);
 
   return result;
 }
@@ -448,10 +476,8 @@ int write(int fd, const void *buffer, unsigned size) {
     debug_printf("(write) fd_e NULL!\n");
   }
 
-  lock_acquire(&file_lock);
   // write to the file
   int result = file_write(fd_e->file_p, buffer, size);
-  lock_release(&file_lock);
 
   debug_printf("(write) result:%d\n", result);
 
@@ -465,9 +491,7 @@ void seek (int fd, unsigned position) {
   if (file_elem == NULL) exit(-1);
 
   // using seek function
-  lock_acquire(&file_lock);
   file_seek(file_elem->file_p, position);
-  lock_release(&file_lock);
 }
 
 int filesize(int fd) {
@@ -475,9 +499,7 @@ int filesize(int fd) {
   if (file_elem == NULL) exit(-1);
 
   // using length function
-  lock_acquire(&file_lock);
   int result = file_length(file_elem->file_p);
-  lock_release(&file_lock);
   return result;
 }
 
@@ -486,9 +508,7 @@ unsigned tell (int fd) {
   if (file_elem == NULL) exit(-1);
 
   // using tell function
-  lock_acquire(&file_lock);
   unsigned result = file_tell(file_elem->file_p);
-  lock_release(&file_lock);
   return result;
 }
 
@@ -501,9 +521,7 @@ void close (int fd) {
   if (fd_e == NULL) exit(-1);
 
   // read file
-  lock_acquire(&file_lock);
-  int result = file_close(fd_e->file_p);
-  lock_release(&file_lock);
+  file_close(fd_e->file_p);
 
   // Now remove file descriptor elemenet
   list_remove(&fd_e->file_list_e);
@@ -520,9 +538,7 @@ void close (int fd) {
 bool mkdir(const char *dir) {
   bool success;
 
-  lock_acquire(&file_lock);
   success = filesys_create(dir, 0, true);
-  lock_release(&file_lock);
 
   return success;
 }
@@ -562,4 +578,52 @@ bool chdir(const char *dir) {
   dir_close(thread_current()->cwd);
   thread_current()->cwd = new_dir;
   return true;
-}
\ No newline at end of file
+}
+/* Copy the file system statistics into the user's STATS.  They are
+   gathered into a kernel copy first, so that no file system lock is
+   held while touching user memory */
+bool fsstat(struct fsstat *stats) {
+  struct fsstat snapshot;
+
+  filesys_get_stats(&snapshot);
+  memcpy(stats, &snapshot, sizeof snapshot);
+  return true;
+}
+
+/* Write the data blocks, index blocks and inode of the file open as fd
+   back to disk, along with the free map */
+bool fsync(int fd) {
+  struct file_inst *file_inst = locate_file(fd);
+  if (file_inst == NULL) {
+    return false;
+  }
+
+  inode_sync(file_get_inode(file_inst->file_p), false);
+  return true;
+}
+
+/* Write the data blocks of the file open as fd back to disk, along
+   with its inode and index blocks only if its length or block map
+   changed since they were last committed */
+bool fdatasync(int fd) {
+  struct file_inst *file_inst = locate_file(fd);
+  if (file_inst == NULL) {
+    return false;
+  }
+
+  inode_sync(file_get_inode(file_inst->file_p), true);
+  return true;
+}
+
+/* Allocate the space for bytes offset...offset + length - 1 of the file
+   open as fd, extending it to offset + length bytes if it is shorter.
+   The space reads as zeros until written, and writing it later takes
+   no allocation */
+bool fallocate(int fd, unsigned offset, unsigned length) {
+  struct file_inst *file_inst = locate_file(fd);
+  if (file_inst == NULL || (int) offset < 0 || (int) length <= 0) {
+    return false;
+  }
+
+  return inode_fallocate(file_get_inode(file_inst->file_p), offset, length);
+}
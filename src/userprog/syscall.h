@@ -3,6 +3,7 @@
 
 #include "threads/synch.h"
 #include <debug.h>
+#include <fsstat.h>
 #include <stdbool.h>
 
 void syscall_init(void);
@@ -20,7 +21,6 @@ struct file_inst
 };
 
 /** Projects 2 and later. */
-struct lock file_lock;
 struct lock process_lock;
 
 void halt(void);
@@ -42,4 +42,8 @@ bool readdir (int fd, char *name);
 bool isdir(int fd);
 int inumber(int fd);
 bool chdir (const char *dir);
+bool fsstat (struct fsstat *stats);
+bool fsync (int fd);
+bool fdatasync (int fd);
+bool fallocate (int fd, unsigned offset, unsigned length);
 #endif /**< userprog/syscall.h */